@@ -0,0 +1,48 @@
+#version 430 core
+
+// Filters of the post-process bloom, see bloom.h. Every mode draws one level of the chain from the texture on u_sourceTexture.
+
+#define MODE_PREFILTER 0 // Keeps what is brighter than the threshold, while downsampling the accumulation to the first level
+#define MODE_DOWNSAMPLE 1
+#define MODE_UPSAMPLE 2 // Tent filter, added to the target by blending
+
+in vec2 fragUV;
+out vec4 fragColor;
+
+uniform sampler2D u_sourceTexture;
+uniform int u_mode;
+uniform vec2 u_sourceScale; // Part of the source covered by the image, below 1 when the accumulation holds a preview
+uniform float u_threshold; // Luminance under which pixels don't glow
+uniform float u_strength; // Applied once by the prefilter, so that the display pass only has to add the result
+
+float luminance(vec3 color) {
+	return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+vec3 sampleSource(vec2 uv) {
+	vec2 sourceSize = vec2(textureSize(u_sourceTexture, 0));
+	uv = clamp(uv * u_sourceScale, vec2(0.5) / sourceSize, (u_sourceScale * sourceSize - vec2(0.5)) / sourceSize);
+	return texture(u_sourceTexture, uv).rgb;
+}
+
+// Four bilinear taps, which average the 4x4 source texels around the target texel
+vec3 downsample(vec2 uv) {
+	vec2 texel = 1.0 / (u_sourceScale * vec2(textureSize(u_sourceTexture, 0)));
+	return (sampleSource(uv + vec2(-texel.x, -texel.y)) + sampleSource(uv + vec2(texel.x, -texel.y)) + sampleSource(uv + vec2(-texel.x, texel.y)) + sampleSource(uv + vec2(texel.x, texel.y))) / 4.0;
+}
+
+void main() {
+	if (u_mode == MODE_PREFILTER) {
+		vec3 color = downsample(fragUV);
+		float colorLuminance = luminance(color);
+		fragColor = vec4(color * max(colorLuminance - u_threshold, 0.0) / max(colorLuminance, 0.0001) * u_strength, 1.0);
+	} else if (u_mode == MODE_DOWNSAMPLE) {
+		fragColor = vec4(downsample(fragUV), 1.0);
+	} else {
+		vec2 texel = 1.0 / vec2(textureSize(u_sourceTexture, 0));
+		vec3 color = sampleSource(fragUV) * 4.0;
+		color += (sampleSource(fragUV + vec2(-texel.x, 0)) + sampleSource(fragUV + vec2(texel.x, 0)) + sampleSource(fragUV + vec2(0, -texel.y)) + sampleSource(fragUV + vec2(0, texel.y))) * 2.0;
+		color += sampleSource(fragUV + vec2(-texel.x, -texel.y)) + sampleSource(fragUV + vec2(texel.x, -texel.y)) + sampleSource(fragUV + vec2(-texel.x, texel.y)) + sampleSource(fragUV + vec2(texel.x, texel.y));
+		fragColor = vec4(color / 16.0, 1.0);
+	}
+}
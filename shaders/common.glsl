@@ -0,0 +1,806 @@
+// Scene description, intersection and sampling code shared by the fragment shader and the wavefront compute stages
+
+#define BVH_STACK_SIZE 32 // Must be at least BVH_MAX_DEPTH in bvh.h
+#define NO_HIT -1
+#define PLANE_HIT -2
+
+#define RENDER_DISTANCE 10000
+#define EPSILON 0.0001
+#define PI 3.1415926538
+
+#define ADAPTIVE_MIN_PASSES 16 // Passes every pixel receives before adaptive sampling can stop tracing it
+#define ADAPTIVE_MIN_LUMINANCE 0.1 // Dark pixels are held to the error allowed at this luminance rather than to a vanishing one
+
+struct Ray {
+	vec3 origin;
+	vec3 direction;
+};
+
+struct Material {
+	vec3 albedo;
+	vec3 specular;
+	vec3 emission;
+	float emissionStrength;
+	float roughness;
+	float specularHighlight;
+	float specularExponent;
+};
+
+struct SurfacePoint {
+	vec3 position;
+	vec3 normal;
+	Material material;
+};
+
+// Minimal hit record kept during traversal. Position, normal and material are only resolved once the closest hit is known.
+struct Hit {
+	float distance;
+	int objectIndex; // NO_HIT, PLANE_HIT or an index into u_objects
+};
+
+struct Object {
+	uint type;
+	vec3 position;
+	vec3 scale;
+	Material material;
+};
+
+// Same memory layout as Scene::Material and Scene::Object (tightly packed floats) so the whole object list can be uploaded in one buffer call
+struct PackedMaterial {
+	float albedo[3];
+	float specular[3];
+	float emission[3];
+	float emissionStrength;
+	float roughness;
+	float specularHighlight;
+	float specularExponent;
+};
+
+struct PackedObject {
+	uint type;
+	float position[3];
+	float scale[3];
+	PackedMaterial material;
+};
+
+struct BVHNode {
+	float boundsMin[3];
+	int leftFirst; // Interior nodes: index of the left child (the right child directly follows it). Leaves: index of the first primitive.
+	float boundsMax[3];
+	int primitiveCount; // 0 for interior nodes
+};
+
+struct PointLight {
+	vec3 position;
+	float radius;
+	vec3 color;
+	float power;
+	float reach; // Only points within this distance of the light will be affected
+};
+
+// Same memory layout as Scene::PointLight
+struct PackedPointLight {
+	float position[3];
+	float radius;
+	float color[3];
+	float power;
+	float reach;
+};
+
+struct LightTreeNode {
+	float boundsMin[3];
+	int leftFirst; // Interior nodes: index of the left child (the right child directly follows it). Leaves: index of the light.
+	float boundsMax[3];
+	int lightCount; // 1 for leaves, 0 for interior nodes
+	float power; // Summed luminance times power of every light below the node
+	float reach; // Largest reach of the lights below the node
+};
+
+uniform sampler2D u_skyboxTexture;
+uniform sampler2D u_skyboxMarginalCdf; // One row: CDF of picking each row of the skybox
+uniform sampler2D u_skyboxConditionalCdf; // CDF of picking each texel, one row per skybox row
+uniform bool u_skyboxSampling; // Whether the CDF textures are valid
+uniform float u_time;
+uniform vec3 u_cameraPosition;
+uniform mat4 u_rotationMatrix;
+uniform float u_aspectRatio;
+
+uniform int u_lightBounces;
+uniform int u_rouletteDepth; // Bounces traced before Russian roulette can end a path
+uniform int u_framePasses;
+uniform bool u_packedAccumulation; // Whether the accumulation targets store half floats
+uniform float u_adaptiveThreshold; // Relative error under which a pixel stops being sampled, 0 to sample every pixel every pass
+uniform float u_blur;
+uniform float u_skyboxStrength;
+uniform float u_skyboxGamma;
+uniform float u_skyboxCeiling;
+uniform int u_objectCount;
+uniform bool u_planeVisible;
+uniform Material u_planeMaterial;
+
+layout(std430, binding = 0) readonly buffer ObjectBuffer {
+	PackedObject u_objects[];
+};
+
+layout(std430, binding = 1) readonly buffer BVHNodeBuffer {
+	BVHNode u_bvhNodes[];
+};
+
+layout(std430, binding = 2) readonly buffer BVHPrimitiveBuffer {
+	int u_bvhPrimitives[]; // Object indices referenced by the leaves
+};
+
+layout(std430, binding = 8) readonly buffer EmitterBuffer {
+	int u_emitterCount;
+	int u_emitters[]; // Indices of the objects for which isEmitter() is true
+};
+
+layout(std430, binding = 9) readonly buffer LightBuffer {
+	PackedPointLight u_lights[];
+};
+
+layout(std430, binding = 10) readonly buffer LightTreeBuffer {
+	LightTreeNode u_lightTree[];
+};
+
+layout(std430, binding = 11) buffer ConvergenceBuffer {
+	uint u_convergedPixels; // Pixels skipped by adaptive sampling during the current pass
+};
+
+vec3 unpackVec3(float v[3]) {
+	return vec3(v[0], v[1], v[2]);
+}
+
+Object getObject(int index) {
+	PackedObject o = u_objects[index];
+	PackedMaterial m = o.material;
+	return Object(o.type, unpackVec3(o.position), unpackVec3(o.scale), Material(unpackVec3(m.albedo), unpackVec3(m.specular), unpackVec3(m.emission), m.emissionStrength, m.roughness, m.specularHighlight, m.specularExponent));
+}
+
+PointLight getLight(int index) {
+	PackedPointLight l = u_lights[index];
+	return PointLight(unpackVec3(l.position), l.radius, unpackVec3(l.color), l.power, l.reach);
+}
+
+float rand(vec2 co){
+    return fract(sin(dot(co, vec2(12.9898, 78.233))) * 43758.5453);
+}
+
+uint pcgHash(uint v) {
+	uint state = v * 747796405u + 2891336453u;
+	uint word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+	return (word >> 22u) ^ word;
+}
+
+// rand() only produces a few hundred distinct values, so choices whose probability can be tiny use this integer hash instead (24 bits of resolution)
+float preciseRand(vec2 co) {
+	return float(pcgHash(floatBitsToUint(co.x) ^ pcgHash(floatBitsToUint(co.y))) >> 8) / 16777216.0;
+}
+
+bool sphereIntersection(vec3 position, float radius, Ray ray, out float hitDistance){
+    float t = dot(position - ray.origin, ray.direction);
+	vec3 p = ray.origin + ray.direction * t;
+
+	float y = length(position - p);
+	if (y < radius) { 
+		float x =  sqrt(radius*radius - y*y);
+		float t1 = t-x;
+		if (t1 >  0) {
+			hitDistance = t1;
+			return true;
+		}
+
+	}
+	
+	return false;
+}
+
+bool boxIntersection(vec3 position, vec3 size, Ray ray, out float hitDistance) {
+	float t1 = -1000000000000.0;
+    float t2 = 1000000000000.0;
+
+	vec3 boxMin = position - size / 2.0;
+	vec3 boxMax = position + size / 2.0;
+
+    vec3 t0s = (boxMin - ray.origin) / ray.direction;
+    vec3 t1s = (boxMax - ray.origin) / ray.direction;
+
+    vec3 tsmaller = min(t0s, t1s);
+    vec3 tbigger = max(t0s, t1s);
+
+    t1 = max(t1, max(tsmaller.x, max(tsmaller.y, tsmaller.z)));
+    t2 = min(t2, min(tbigger.x, min(tbigger.y, tbigger.z)));
+
+	hitDistance = t1;
+
+    return t1 >= 0 && t1 <= t2;
+}
+
+vec3 boxNormal(vec3 cubePosition, vec3 size, vec3 surfacePosition)
+{
+    // Source: https://gist.github.com/Shtille/1f98c649abeeb7a18c5a56696546d3cf
+    // step(edge,x) : x < edge ? 0 : 1
+
+	vec3 boxMin = cubePosition - size / 2.0;
+	vec3 boxMax = cubePosition + size / 2.0;
+
+	vec3 center = (boxMax + boxMin) * 0.5;
+	vec3 boxSize = (boxMax - boxMin) * 0.5;
+	vec3 pc = surfacePosition - center;
+	// step(edge,x) : x < edge ? 0 : 1
+	vec3 normal = vec3(0.0);
+	normal += vec3(sign(pc.x), 0.0, 0.0) * step(abs(abs(pc.x) - boxSize.x), EPSILON);
+	normal += vec3(0.0, sign(pc.y), 0.0) * step(abs(abs(pc.y) - boxSize.y), EPSILON);
+	normal += vec3(0.0, 0.0, sign(pc.z)) * step(abs(abs(pc.z) - boxSize.z), EPSILON);
+	return normalize(normal);
+}
+
+bool planeIntersection(vec3 planeNormal, vec3 planePoint, Ray ray, out float hitDistance) 
+{ 
+    float denom = dot(planeNormal, ray.direction); 
+    if (abs(denom) > EPSILON) { 
+        vec3 d = planePoint - ray.origin; 
+        hitDistance = dot(d, planeNormal) / denom; 
+        return (hitDistance >= EPSILON); 
+    } 
+ 
+    return false; 
+} 
+
+// Slab test against the bounds of a BVH node. Returns the distance at which the ray enters the node, or RENDER_DISTANCE if it misses it or enters it beyond maxDist.
+float nodeIntersection(int nodeIndex, Ray ray, vec3 inverseDirection, float maxDist) {
+	vec3 t0s = (unpackVec3(u_bvhNodes[nodeIndex].boundsMin) - ray.origin) * inverseDirection;
+	vec3 t1s = (unpackVec3(u_bvhNodes[nodeIndex].boundsMax) - ray.origin) * inverseDirection;
+
+	vec3 tsmaller = min(t0s, t1s);
+	vec3 tbigger = max(t0s, t1s);
+
+	float tNear = max(0.0, max(tsmaller.x, max(tsmaller.y, tsmaller.z)));
+	float tFar = min(tbigger.x, min(tbigger.y, tbigger.z));
+
+	return (tNear <= tFar && tNear < maxDist) ? tNear : float(RENDER_DISTANCE);
+}
+
+// The root of an empty BVH has neither primitives nor children (interior nodes never point back to index 0)
+bool bvhEmpty() {
+	return u_bvhNodes[0].primitiveCount == 0 && u_bvhNodes[0].leftFirst == 0;
+}
+
+bool intersectObject(int objectIndex, Ray ray, out float hitDistance) {
+	uint type = u_objects[objectIndex].type;
+	vec3 position = unpackVec3(u_objects[objectIndex].position);
+
+	if (type == 1) return sphereIntersection(position, u_objects[objectIndex].scale[0], ray, hitDistance);
+	if (type == 2) return boxIntersection(position, unpackVec3(u_objects[objectIndex].scale), ray, hitDistance);
+	return false;
+}
+
+Hit closestHit(Ray ray) {
+	Hit hit = Hit(RENDER_DISTANCE, NO_HIT);
+
+	// Testing the plane first lets it prune the BVH traversal
+	float hitDist;
+	if (u_planeVisible && planeIntersection(vec3(0,1,0), vec3(0, 0, 0), ray, hitDist) && hitDist < hit.distance) {
+		hit = Hit(hitDist, PLANE_HIT);
+	}
+
+	if (bvhEmpty()) return hit;
+
+	// Closest-hit BVH traversal. The nearer child is visited first and the farther one is pushed on a short stack, which never holds more than one node per level.
+	vec3 inverseDirection = 1.0 / ray.direction;
+	int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	int nodeIndex = 0;
+	if (nodeIntersection(0, ray, inverseDirection, hit.distance) >= hit.distance) return hit;
+	while (true) {
+		BVHNode node = u_bvhNodes[nodeIndex];
+		if (node.primitiveCount > 0) {
+			for (int i = node.leftFirst; i < node.leftFirst + node.primitiveCount; i++) {
+				int objectIndex = u_bvhPrimitives[i];
+				if (intersectObject(objectIndex, ray, hitDist) && hitDist < hit.distance) {
+					hit = Hit(hitDist, objectIndex);
+				}
+			}
+		} else {
+			int nearChild = node.leftFirst;
+			int farChild = node.leftFirst + 1;
+			float nearDist = nodeIntersection(nearChild, ray, inverseDirection, hit.distance);
+			float farDist = nodeIntersection(farChild, ray, inverseDirection, hit.distance);
+			if (farDist < nearDist) {
+				nearChild = farChild;
+				farChild = node.leftFirst;
+				float tmp = nearDist;
+				nearDist = farDist;
+				farDist = tmp;
+			}
+
+			if (nearDist < hit.distance) {
+				if (farDist < hit.distance) stack[stackSize++] = farChild;
+				nodeIndex = nearChild;
+				continue;
+			}
+		}
+
+		if (stackSize == 0) break;
+		nodeIndex = stack[--stackSize];
+	}
+
+	return hit;
+}
+
+SurfacePoint resolveHit(Ray ray, Hit hit) {
+	SurfacePoint hitPoint;
+	hitPoint.position = ray.origin + ray.direction * hit.distance;
+
+	if (hit.objectIndex == PLANE_HIT) {
+		hitPoint.normal = vec3(0,1,0);
+		hitPoint.material = u_planeMaterial;
+	} else {
+		Object object = getObject(hit.objectIndex);
+		hitPoint.normal = object.type == 1 ? normalize(hitPoint.position - object.position) : boxNormal(object.position, object.scale, hitPoint.position);
+		hitPoint.material = object.material;
+	}
+
+	return hitPoint;
+}
+
+bool raycast(Ray ray, out SurfacePoint hitPoint) {
+	Hit hit = closestHit(ray);
+	if (hit.objectIndex == NO_HIT) return false;
+
+	hitPoint = resolveHit(ray, hit);
+	return true;
+}
+
+// Any-hit query for shadow rays. Returns as soon as anything is found closer than maxDist and never resolves normals or materials.
+bool occluded(Ray ray, float maxDist) {
+	float hitDist;
+	if (u_planeVisible && planeIntersection(vec3(0,1,0), vec3(0, 0, 0), ray, hitDist) && hitDist < maxDist) return true;
+
+	if (bvhEmpty()) return false;
+
+	// Children are visited in storage order since any hit ends the query
+	vec3 inverseDirection = 1.0 / ray.direction;
+	int stack[BVH_STACK_SIZE];
+	int stackSize = 0;
+	int nodeIndex = 0;
+	if (nodeIntersection(0, ray, inverseDirection, maxDist) >= maxDist) return false;
+	while (true) {
+		BVHNode node = u_bvhNodes[nodeIndex];
+		if (node.primitiveCount > 0) {
+			for (int i = node.leftFirst; i < node.leftFirst + node.primitiveCount; i++) {
+				if (intersectObject(u_bvhPrimitives[i], ray, hitDist) && hitDist < maxDist) return true;
+			}
+		} else {
+			bool hitLeft = nodeIntersection(node.leftFirst, ray, inverseDirection, maxDist) < maxDist;
+			bool hitRight = nodeIntersection(node.leftFirst + 1, ray, inverseDirection, maxDist) < maxDist;
+			if (hitLeft) {
+				if (hitRight) stack[stackSize++] = node.leftFirst + 1;
+				nodeIndex = node.leftFirst;
+				continue;
+			}
+			if (hitRight) {
+				nodeIndex = node.leftFirst + 1;
+				continue;
+			}
+		}
+
+		if (stackSize == 0) return false;
+		nodeIndex = stack[--stackSize];
+	}
+}
+
+// Adapted from https://bitbucket.org/Daerst/gpu-ray-tracing-in-unity/src/Tutorial_Pt2/Assets/RayTracingShader.compute
+mat3x3 getTangentSpace(vec3 normal)
+{
+    // Choose a helper vector for the cross product
+    vec3 helper = vec3(1, 0, 0);
+    if (abs(normal.x) > 0.99)
+        helper = vec3(0, 0, 1);
+
+    // Generate vectors
+    vec3 tangent = normalize(cross(normal, helper));
+    vec3 binormal = normalize(cross(normal, tangent));
+    return mat3x3(tangent, binormal, normal);
+}
+
+// Basic rejection sampling method
+vec3 _sampleHemisphere(vec3 normal, vec2 seed)
+{
+    vec3 vec = normalize(vec3(rand(seed)*2.0-1.0,rand(seed.yx+vec2(1.123123123,2.545454))*2.0-1.0,rand(seed-vec2(9.21428,7.43163431))*2.0-1.0));
+	if (dot(vec, normal) < 0.0) vec *= -1; 
+
+	return vec;
+}
+
+// Adapted from https://bitbucket.org/Daerst/gpu-ray-tracing-in-unity/src/Tutorial_Pt2/Assets/RayTracingShader.compute
+vec3 sampleHemisphere(vec3 normal, float alpha, vec2 seed)
+{
+    // Sample the hemisphere, where alpha determines the kind of the sampling
+    float cosTheta = pow(rand(seed), 1.0 / (alpha + 1.0));
+    float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+    float phi = 2 * PI * rand(seed.yx);
+    vec3 tangentSpaceDir = vec3(cos(phi) * sinTheta, sin(phi) * sinTheta, cosTheta);
+
+    // Transform direction to world space
+    return getTangentSpace(normal) * tangentSpaceDir;
+}
+
+vec3 sampleSkybox(vec3 dir) {
+	if (u_skyboxStrength == 0.0) return vec3(0.0);
+	
+	return min(vec3(u_skyboxCeiling), u_skyboxStrength*pow(texture(u_skyboxTexture, vec2(0.5 + atan(dir.x, dir.z)/(2*PI), 0.5 + asin(-dir.y)/PI)).xyz, vec3(1.0/u_skyboxGamma)));
+}
+
+// The skybox is sampled in proportion to the brightness of its texels, using the CDF tables built by Scene::loadSkybox
+
+// Index of the first entry of a CDF row greater than u
+int searchCdf(sampler2D cdf, int row, int size, float u) {
+	int low = 0, high = size - 1;
+	while (low < high) {
+		int middle = (low + high) / 2;
+		if (texelFetch(cdf, ivec2(middle, row), 0).r > u) high = middle;
+		else low = middle + 1;
+	}
+	return low;
+}
+
+float cdfStart(sampler2D cdf, int row, int index) {
+	return index > 0 ? texelFetch(cdf, ivec2(index - 1, row), 0).r : 0.0;
+}
+
+bool skyboxSamplingEnabled() {
+	return u_skyboxSampling && u_skyboxStrength > 0.0;
+}
+
+// Probability density (per solid angle) of sampleSkyboxDirection() picking a direction
+float skyboxPdf(vec3 dir) {
+	ivec2 size = textureSize(u_skyboxConditionalCdf, 0);
+	vec2 uv = vec2(0.5 + atan(dir.x, dir.z)/(2*PI), 0.5 + asin(-dir.y)/PI);
+	int column = clamp(int(uv.x * size.x), 0, size.x - 1);
+	int row = clamp(int(uv.y * size.y), 0, size.y - 1);
+
+	float rowChance = texelFetch(u_skyboxMarginalCdf, ivec2(row, 0), 0).r - cdfStart(u_skyboxMarginalCdf, 0, row);
+	float columnChance = texelFetch(u_skyboxConditionalCdf, ivec2(column, row), 0).r - cdfStart(u_skyboxConditionalCdf, row, column);
+
+	// Texel probability -> density over the image -> density over the sphere
+	float sinTheta = sqrt(max(1.0 - dir.y * dir.y, 0.0));
+	if (sinTheta <= 0.0) return 0.0;
+	return rowChance * columnChance * size.x * size.y / (2 * PI * PI * sinTheta);
+}
+
+// Picks a direction in proportion to the skybox's brightness. Outputs the pdf of that direction.
+vec3 sampleSkyboxDirection(vec2 co, float seed, out float pdf) {
+	ivec2 size = textureSize(u_skyboxConditionalCdf, 0);
+	float u1 = preciseRand(co + vec2(seed, 11));
+	float u2 = preciseRand(co + vec2(seed, 12));
+
+	int row = searchCdf(u_skyboxMarginalCdf, 0, size.y, u1);
+	int column = searchCdf(u_skyboxConditionalCdf, row, size.x, u2);
+
+	// Position inside the picked texel
+	float rowStart = cdfStart(u_skyboxMarginalCdf, 0, row);
+	float rowChance = texelFetch(u_skyboxMarginalCdf, ivec2(row, 0), 0).r - rowStart;
+	float columnStart = cdfStart(u_skyboxConditionalCdf, row, column);
+	float columnChance = texelFetch(u_skyboxConditionalCdf, ivec2(column, row), 0).r - columnStart;
+	vec2 uv = vec2((column + clamp((u2 - columnStart) / columnChance, 0.0, 1.0)) / size.x, (row + clamp((u1 - rowStart) / rowChance, 0.0, 1.0)) / size.y);
+
+	// Inverse of the mapping used by sampleSkybox
+	float phi = (uv.x - 0.5) * 2 * PI;
+	float theta = uv.y * PI;
+	vec3 dir = vec3(sin(phi) * sin(theta), cos(theta), cos(phi) * sin(theta));
+
+	pdf = sin(theta) > 0.0 ? rowChance * columnChance * size.x * size.y / (2 * PI * PI * sin(theta)) : 0.0;
+	return dir;
+}
+
+// Primary ray through a screen position (0-1 on both axes). The optional blur jitter doubles as anti-aliasing.
+Ray generateCameraRay(vec2 uv, bool jitter, float time) {
+	vec2 centeredUV = (uv * 2 - vec2(1)) * vec2(u_aspectRatio, 1.0);
+	if (jitter && u_blur > 0.0) centeredUV += vec2(rand(vec2(1, time)+uv.xy)*u_blur-u_blur/2, rand(vec2(2, time)+uv.yx)*u_blur-u_blur/2);
+	vec3 rayDir = (normalize(vec4(centeredUV, -1.0, 0.0)) * u_rotationMatrix).xyz;
+	return Ray(u_cameraPosition, rayDir);
+}
+
+// 1 - cos of the half angle of the cone a sphere covers as seen from the given position. Inside the sphere the "cone" is every direction.
+// Written so that it doesn't round to 0 for small or distant spheres.
+float sphereConeAperture(vec3 center, float radius, vec3 position) {
+	vec3 toCenter = center - position;
+	float sinThetaMax2 = radius * radius / dot(toCenter, toCenter);
+	return sinThetaMax2 < 1.0 ? sinThetaMax2 / (1.0 + sqrt(1.0 - sinThetaMax2)) : 2.0;
+}
+
+// Picks a direction towards a sphere, uniformly distributed over the solid angle the sphere covers as seen from the given position (cone sampling).
+// Returns the distance to the sphere's surface along that direction.
+float sampleSphereCone(vec3 center, float radius, vec3 position, float seed, out vec3 direction) {
+	vec3 toLight = center - position;
+	float lightDistance = length(toLight);
+
+	float cosTheta = 1.0 - rand(vec2(seed, 1)+position.xy) * sphereConeAperture(center, radius, position);
+	float sinTheta = sqrt(max(1.0 - cosTheta * cosTheta, 0.0));
+	float phi = 2 * PI * rand(vec2(seed, 2)+position.yz);
+	direction = getTangentSpace(toLight / lightDistance) * vec3(cos(phi) * sinTheta, sin(phi) * sinTheta, cosTheta);
+
+	// Ray/sphere intersection, taking the far side when starting inside the sphere
+	float b = dot(direction, toLight);
+	float c = lightDistance * lightDistance - radius * radius;
+	float root = sqrt(max(b * b - c, 0.0));
+	return c > 0.0 ? b - root : b + root;
+}
+
+// Unshadowed light received at a point from a point light. The highlight is added as is.
+// The diffuse term does not include the cosine factor: the light is treated as a sphere whose radiance is spread so that its unshadowed irradiance matches the point light formula.
+// Because that radiance and the pdf of sampleSphereCone are both 1/(solid angle of the sphere), each cone sample contributes diffuseTerm * max(dot(normal, direction), 0) if it isn't occluded.
+// Returns false if the light doesn't affect the point at all.
+bool pointLightTerms(PointLight light, SurfacePoint point, vec3 observerPos, out vec3 diffuseTerm, out vec3 highlightTerm) {
+	float lightDistance = length(light.position - point.position);
+	if (lightDistance > light.reach) return false;
+
+	// The whole sphere is below the surface's horizon
+	float horizon = dot(point.normal, normalize(light.position-point.position)) + min(light.radius / lightDistance, 1.0);
+	if (horizon <= EPSILON && point.material.roughness >= 1.0) return false;
+
+	// Diffuse
+	float attenuation = lightDistance * lightDistance;
+	diffuseTerm = light.color * light.power * point.material.albedo / attenuation;
+
+	// Specular highlight
+	vec3 lightDir = normalize(point.position - light.position);
+	vec3 reflectedLightDir = reflect(lightDir, point.normal);
+	vec3 cameraDir = normalize(observerPos - point.position);
+	highlightTerm = point.material.specularHighlight * light.color * (light.power/attenuation) * pow(max(dot(cameraDir, reflectedLightDir), 0.0), 1.0/max(point.material.specularExponent, EPSILON));
+
+	return true;
+}
+
+// The root of an empty light tree has neither a light nor children
+bool lightTreeEmpty() {
+	return u_lightTree[0].lightCount == 0 && u_lightTree[0].leftFirst == 0;
+}
+
+// Estimated contribution of the lights below a node: their power over the squared distance to the node, or 0 if none of them can reach the position
+float lightNodeImportance(int nodeIndex, vec3 position) {
+	LightTreeNode node = u_lightTree[nodeIndex];
+	vec3 boundsMin = unpackVec3(node.boundsMin);
+	vec3 boundsMax = unpackVec3(node.boundsMax);
+	if (distance(position, clamp(position, boundsMin, boundsMax)) > node.reach) return 0.0;
+
+	// The distance is clamped to the node's size so that positions inside or right next to a node don't give it an unbounded weight
+	vec3 toCenter = (boundsMin + boundsMax) * 0.5 - position;
+	vec3 size = boundsMax - boundsMin;
+	return node.power / max(dot(toCenter, toCenter), dot(size, size) * 0.25);
+}
+
+// Picks a light by walking down the light tree, choosing each child in proportion to its importance. Costs O(log lights).
+// Returns the light's index and the probability of picking it, or -1 if no light can reach the position.
+int selectLight(vec3 position, float seed, out float probability) {
+	probability = 1.0;
+	if (lightTreeEmpty() || lightNodeImportance(0, position) <= 0.0) return -1;
+
+	int nodeIndex = 0;
+	for (int level = 0; u_lightTree[nodeIndex].lightCount == 0; level++) {
+		int left = u_lightTree[nodeIndex].leftFirst;
+		float leftImportance = lightNodeImportance(left, position);
+		float rightImportance = lightNodeImportance(left + 1, position);
+		if (leftImportance + rightImportance <= 0.0) return -1;
+
+		float leftChance = leftImportance / (leftImportance + rightImportance);
+		if (preciseRand(position.xz + vec2(seed, level + 7)) < leftChance) {
+			nodeIndex = left;
+			probability *= leftChance;
+		} else {
+			nodeIndex = left + 1;
+			probability *= 1.0 - leftChance;
+		}
+	}
+
+	return u_lightTree[nodeIndex].leftFirst;
+}
+
+// Probability of scatter() choosing the specular or the diffuse reflection
+void reflectionChances(Material material, out float specChance, out float diffChance) {
+	specChance = dot(material.specular, vec3(1.0/3.0));
+	diffChance = dot(material.albedo, vec3(1.0/3.0));
+
+	float sum = specChance + diffChance;
+	specChance /= sum;
+	diffChance /= sum;
+}
+
+// Exponent of the specular lobe sampled around the mirror direction
+float specularAlpha(Material material) {
+	float smoothness = 1.0-material.roughness;
+	return pow(1000.0, smoothness*smoothness);
+}
+
+// Evaluates the reflection scatter() samples for a given outgoing direction. Returns the throughput scatter() would apply times the pdf of picking that direction (the BSDF times the cosine), and outputs that pdf.
+// Perfect mirrors are left out: only scatter() itself can sample them.
+vec3 evaluateScatter(SurfacePoint hitPoint, vec3 incomingDirection, vec3 direction, out float pdf) {
+	pdf = 0.0;
+	vec3 reflection = vec3(0.0);
+
+	float specChance, diffChance;
+	reflectionChances(hitPoint.material, specChance, diffChance);
+	if (!(specChance + diffChance > 0.0)) return reflection;
+
+	float cosine = dot(hitPoint.normal, direction);
+	if (diffChance > 0.0 && cosine > 0.0) {
+		float diffusePdf = cosine / PI;
+		pdf += diffChance * diffusePdf;
+		reflection += diffChance * diffusePdf * hitPoint.material.albedo * cosine;
+	}
+
+	float alpha = specularAlpha(hitPoint.material);
+	float mirrorCosine = dot(reflect(incomingDirection, hitPoint.normal), direction);
+	if (specChance > 0.0 && hitPoint.material.roughness > 0.0 && mirrorCosine > 0.0) {
+		float specularPdf = (alpha + 1) / (2 * PI) * pow(mirrorCosine, alpha);
+		float f = (alpha + 2) / (alpha + 1);
+		pdf += specChance * specularPdf;
+		reflection += specChance * specularPdf * hitPoint.material.specular * clamp(cosine * f, 0.0, 1.0);
+	}
+
+	return reflection;
+}
+
+// Power heuristic weight of a sampling strategy against another one, given both of their pdfs
+float misWeight(float pdf, float otherPdf) {
+	return pdf * pdf / (pdf * pdf + otherPdf * otherPdf);
+}
+
+// Emissive spheres are sampled explicitly (next event estimation). Must match Scene::isEmitter.
+bool isEmitter(Object object) {
+	return object.type == 1 && object.material.emissionStrength > 0.0 && any(greaterThan(object.material.emission, vec3(0.0)));
+}
+
+// Probability density (per solid angle) of sampleEmitter() picking a direction that ends on the given emitter.
+// selectionChance is the probability of sampleEmitter() being called at all.
+float emitterPdf(Object emitter, vec3 position, float selectionChance) {
+	float solidAngle = 2 * PI * sphereConeAperture(emitter.position, emitter.scale.x, position);
+	return selectionChance / (u_emitterCount * solidAngle);
+}
+
+// Picks one emitter at random and a direction towards it. Outputs the ray to test for occlusion and the light it brings if it isn't occluded, weighted against scatter() with multiple importance sampling.
+// Returns false if there is nothing to trace.
+bool sampleEmitter(SurfacePoint point, int pointObjectIndex, vec3 incomingDirection, float seed, float selectionChance, out Ray shadowRay, out float maxDistance, out vec3 contribution) {
+	if (u_emitterCount == 0) return false;
+
+	int emitterIndex = u_emitters[min(int(preciseRand(point.position.xy+vec2(seed, 5)) * u_emitterCount), u_emitterCount - 1)];
+	if (emitterIndex == pointObjectIndex) return false;
+
+	Object emitter = getObject(emitterIndex);
+	vec3 direction;
+	float emitterDistance = sampleSphereCone(emitter.position, emitter.scale.x, point.position, seed + 0.5, direction);
+
+	float scatterPdf;
+	vec3 reflection = evaluateScatter(point, incomingDirection, direction, scatterPdf);
+	if (scatterPdf <= 0.0) return false;
+
+	float lightPdf = emitterPdf(emitter, point.position, selectionChance);
+	contribution = emitter.material.emission * emitter.material.emissionStrength * reflection * misWeight(lightPdf, scatterPdf) / lightPdf;
+
+	shadowRay = Ray(point.position + direction * EPSILON * 2.0, direction);
+	maxDistance = emitterDistance - EPSILON * 4.0;
+	return true;
+}
+
+// Weight of emission found by scatter(), given the pdf it output for the ray that found it
+float emissionWeight(int objectIndex, vec3 rayOrigin, float scatterPdf, float selectionChance) {
+	if (scatterPdf <= 0.0 || objectIndex < 0) return 1.0;
+
+	Object object = getObject(objectIndex);
+	if (!isEmitter(object)) return 1.0;
+	return misWeight(scatterPdf, emitterPdf(object, rayOrigin, selectionChance));
+}
+
+// Samples a direction towards the skybox. Outputs the ray to test for occlusion and the light it brings if nothing blocks it, weighted against scatter() with multiple importance sampling.
+// Returns false if there is nothing to trace.
+bool sampleSkyboxLight(SurfacePoint point, vec3 incomingDirection, float seed, float selectionChance, out Ray shadowRay, out vec3 contribution) {
+	if (!skyboxSamplingEnabled()) return false;
+
+	float lightPdf;
+	vec3 direction = sampleSkyboxDirection(point.position.xz + vec2(point.position.y), seed, lightPdf);
+	lightPdf *= selectionChance;
+	if (lightPdf <= 0.0) return false;
+
+	float scatterPdf;
+	vec3 reflection = evaluateScatter(point, incomingDirection, direction, scatterPdf);
+	if (scatterPdf <= 0.0) return false;
+
+	contribution = sampleSkybox(direction) * reflection * misWeight(lightPdf, scatterPdf) / lightPdf;
+	shadowRay = Ray(point.position + direction * EPSILON * 2.0, direction);
+	return true;
+}
+
+// Weight of skybox light found by scatter(), given the pdf it output for the ray that escaped
+float skyboxWeight(vec3 direction, float scatterPdf, float selectionChance) {
+	if (scatterPdf <= 0.0 || !skyboxSamplingEnabled()) return 1.0;
+	return misWeight(scatterPdf, skyboxPdf(direction) * selectionChance);
+}
+
+float luminance(vec3 color) {
+	return dot(color, vec3(0.2126, 0.7152, 0.0722));
+}
+
+// Randomly ends paths that can only carry little light anymore. Surviving paths are boosted by the inverse of their survival chance, so the result stays unbiased.
+bool russianRoulette(SurfacePoint hitPoint, inout vec3 energy, float seed, int depth) {
+	if (depth + 1 < u_rouletteDepth) return true;
+
+	float survivalChance = min(luminance(energy), 1.0);
+	if (survivalChance <= 0.0 || rand(hitPoint.position.yz+vec2(hitPoint.position.x)+vec2(depth, seed)) >= survivalChance) return false;
+
+	energy /= survivalChance;
+	return true;
+}
+
+// Based on https://bitbucket.org/Daerst/gpu-ray-tracing-in-unity/src/Tutorial_Pt2/Assets/RayTracingShader.compute
+// Chooses the next bounce (specular or diffuse) and updates the path's throughput. Returns false when the path can't carry any more light.
+// pdf receives the density of the chosen direction for multiple importance sampling, or 0 for perfect mirrors.
+bool scatter(SurfacePoint hitPoint, inout vec3 rayOrigin, inout vec3 rayDirection, inout vec3 energy, out float pdf, float seed, int depth) {
+	float specChance, diffChance;
+	reflectionChances(hitPoint.material, specChance, diffChance);
+	vec3 incomingDirection = rayDirection;
+	pdf = 0.0;
+
+	// Roulette-select the ray's path. The random number must not be the one sampleHemisphere uses, or the direction would depend on the choice.
+	float roulette = rand(hitPoint.position.xy+vec2(hitPoint.position.z)+vec2(seed, depth));
+	if (roulette < specChance)
+	{
+		// Specular reflection
+		float smoothness = 1.0-hitPoint.material.roughness;
+		float alpha = specularAlpha(hitPoint.material);
+		if (smoothness == 1.0) {
+			rayDirection = reflect(rayDirection, hitPoint.normal);
+		} else {
+			rayDirection = sampleHemisphere(reflect(rayDirection, hitPoint.normal), alpha, hitPoint.position.zx+vec2(hitPoint.position.y)+vec2(seed, depth));
+		}
+		rayOrigin = hitPoint.position + rayDirection * EPSILON;
+		float f = (alpha + 2) / (alpha + 1);
+		energy *= hitPoint.material.specular * clamp(dot(hitPoint.normal, rayDirection) * f, 0.0, 1.0);
+		if (smoothness < 1.0) evaluateScatter(hitPoint, incomingDirection, rayDirection, pdf);
+		return russianRoulette(hitPoint, energy, seed, depth);
+	}
+	else if (diffChance > 0 && roulette < specChance + diffChance)
+	{
+		// Diffuse reflection
+		rayOrigin = hitPoint.position + hitPoint.normal * EPSILON;
+		rayDirection = sampleHemisphere(hitPoint.normal, 1.0, hitPoint.position.zx+vec2(hitPoint.position.y)+vec2(seed, depth));
+		energy *= hitPoint.material.albedo * clamp(dot(hitPoint.normal, rayDirection), 0.0, 1.0);
+		evaluateScatter(hitPoint, incomingDirection, rayDirection, pdf);
+		return russianRoulette(hitPoint, energy, seed, depth);
+	}
+
+	// This means both the hit material's albedo and specular are totally black, so there won't be anymore light. We can stop here.
+	return false;
+}
+
+// Adaptive sampling. Moments hold, summed over the passes a pixel received: the mean luminance of the pass's samples, the mean squared luminance, and 1.
+// A pixel is converged once the standard error of its mean luminance falls under u_adaptiveThreshold relative to that mean.
+bool pixelConverged(vec4 moments) {
+	if (u_adaptiveThreshold <= 0.0 || moments.z < ADAPTIVE_MIN_PASSES) return false;
+
+	float mean = moments.x / moments.z;
+	float variance = max(moments.y / moments.z - mean * mean, 0.0);
+	float standardError = sqrt(variance / (moments.z * u_framePasses));
+	return standardError < u_adaptiveThreshold * max(mean, ADAPTIVE_MIN_LUMINANCE);
+}
+
+// Half-float accumulation targets round every store, and plain rounding stops a running mean from moving once a pass changes it by less than half a step.
+// Rounding up or down at random, with chances proportional to the distance to each neighbour, keeps the mean unbiased.
+vec3 accumulationColor(vec3 color, vec2 co) {
+	if (!u_packedAccumulation) return color;
+
+	vec3 rounded;
+	for (int i = 0; i < 3; i++) {
+		uint bits = packHalf2x16(vec2(color[i], 0.0));
+		float nearest = unpackHalf2x16(bits).x;
+		if (color[i] <= 0.0 || nearest == color[i]) {
+			rounded[i] = nearest;
+			continue;
+		}
+
+		float other = unpackHalf2x16(nearest > color[i] ? bits - 1u : bits + 1u).x;
+		float low = min(nearest, other), high = max(nearest, other);
+		rounded[i] = preciseRand(co + vec2(i, 17)) < (color[i] - low) / (high - low) ? high : low;
+	}
+	return rounded;
+}
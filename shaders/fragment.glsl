@@ -1,284 +1,141 @@
 #version 430 core
 
-#define MAX_OBJECT_COUNT 64
-#define MAX_LIGHT_COUNT 4
+#include "common.glsl"
 
-#define RENDER_DISTANCE 10000
-#define EPSILON 0.0001
-#define PI 3.1415926538
-#define OUTLINE_WIDTH 0.004
+#define OUTLINE_WIDTH 2 // In screen pixels
 #define OUTLINE_COLOR vec4(1.0, 0.0, 1.0, 1.0)
+#define REPROJECTION_DEPTH_TOLERANCE 0.02 // Largest distance between the old and new surface, relative to the distance from the camera
+#define REPROJECTION_NORMAL_THRESHOLD 0.9 // Smallest cosine between the old and new surface normal
 
 in vec2 fragUV;
-out vec4 fragColor;
-
-struct Ray {
-	vec3 origin;
-	vec3 direction;
-};
-
-struct Material {
-	vec3 albedo;
-	vec3 specular;
-	vec3 emission;
-	float emissionStrength;
-	float roughness;
-	float specularHighlight;
-	float specularExponent;
-};
-
-struct SurfacePoint {
-	vec3 position;
-	vec3 normal;
-	Material material;
-};
-
-struct Object {
-	uint type;
-	vec3 position;
-	vec3 scale;
-	Material material;
-};
-
-struct PointLight {
-	vec3 position;
-	float radius;
-	vec3 color;
-	float power;
-	float reach; // Only points within this distance of the light will be affected
-};
-
-uniform sampler2D u_screenTexture;
-uniform sampler2D u_skyboxTexture;
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec4 fragMoments; // Accumulated luminance moments, see pixelConverged()
+layout(location = 2) out vec4 fragGeometry; // Normal and distance of the surface hit by the pixel's center ray, 0 for the sky
+layout(location = 3) out int fragObjectId; // Object hit by the pixel's center ray, used to draw the selection outline and to pick objects with the mouse
+
+uniform sampler2D u_screenTexture; // Mean of every pass accumulated so far
+uniform sampler2D u_momentsTexture;
+uniform sampler2D u_geometryTexture;
+uniform isampler2D u_objectIdTexture;
 uniform int u_accumulatedPasses; // How many passes have been added to the texture
+uniform vec2 u_renderScale; // Fraction of the accumulation targets covered by the render resolution (below 1 while previewing)
 uniform bool u_directOutputPass; // If this is true, the shader will draw the input texture directly to the screen. (Used to draw the contents of the FBO to the screen)
-uniform float u_time;
-uniform vec3 u_cameraPosition;
-uniform mat4 u_rotationMatrix;
-uniform float u_aspectRatio;
 uniform bool u_debugKeyPressed;
 
-uniform int u_shadowResolution;
-uniform int u_lightBounces;
-uniform int u_framePasses;
-uniform float u_blur;
-uniform float u_bloomRadius;
+uniform bool u_reprojectionPass; // If this is true, the shader will warp the accumulation into the current camera's view instead of adding a pass to it
+uniform bool u_historyValid; // When false, the reprojection pass discards the whole accumulation and only records the geometry
+uniform vec3 u_previousCameraPosition;
+uniform mat4 u_previousRotationMatrix;
+uniform int u_maxHistory; // Passes a reprojected pixel is allowed to carry over, so that samples taken from other viewpoints fade out
+uniform ivec4 u_resetRegion; // Pixels whose accumulation the reprojection pass discards even though they see the same surface, because an edit changed it (min corner inclusive, max corner exclusive)
+uniform bool u_cameraUnchanged; // When true, the pixels outside u_resetRegion keep their accumulation as is, without being warped or having their history capped
+
+uniform int u_shadowRays; // Per bounce
+uniform sampler2D u_bloomTexture; // Computed from the accumulation by the bloom post-process, see bloom.h
 uniform float u_bloomIntensity;
-uniform float u_skyboxStrength;
-uniform float u_skyboxGamma;
-uniform float u_skyboxCeiling;
-uniform Object u_objects[MAX_OBJECT_COUNT];
-uniform PointLight u_lights[MAX_LIGHT_COUNT];
-uniform bool u_planeVisible;
-uniform Material u_planeMaterial;
 
 uniform int u_selectedSphereIndex;
 
-float rand(vec2 co){
-    return fract(sin(dot(co, vec2(12.9898, 78.233))) * 43758.5453);
-}
-
-bool sphereIntersection(vec3 position, float radius, Ray ray, out float hitDistance){
-    float t = dot(position - ray.origin, ray.direction);
-	vec3 p = ray.origin + ray.direction * t;
-
-	float y = length(position - p);
-	if (y < radius) { 
-		float x =  sqrt(radius*radius - y*y);
-		float t1 = t-x;
-		if (t1 >  0) {
-			hitDistance = t1;
-			return true;
-		}
-
-	}
-	
-	return false;
-}
-
-bool boxIntersection(vec3 position, vec3 size, Ray ray, out float hitDistance) {
-	float t1 = -1000000000000.0;
-    float t2 = 1000000000000.0;
-
-	vec3 boxMin = position - size / 2.0;
-	vec3 boxMax = position + size / 2.0;
-
-    vec3 t0s = (boxMin - ray.origin) / ray.direction;
-    vec3 t1s = (boxMax - ray.origin) / ray.direction;
-
-    vec3 tsmaller = min(t0s, t1s);
-    vec3 tbigger = max(t0s, t1s);
-
-    t1 = max(t1, max(tsmaller.x, max(tsmaller.y, tsmaller.z)));
-    t2 = min(t2, min(tbigger.x, min(tbigger.y, tbigger.z)));
-
-	hitDistance = t1;
-
-    return t1 >= 0 && t1 <= t2;
-}
+// Estimates the light received directly from the point lights. Each shadow ray goes to one light picked by the light tree.
+vec3 computeDirectIllumination(SurfacePoint point, vec3 observerPos, float seed) {
+	vec3 directIllumination = vec3(0);
 
-vec3 boxNormal(vec3 cubePosition, vec3 size, vec3 surfacePosition)
-{
-    // Source: https://gist.github.com/Shtille/1f98c649abeeb7a18c5a56696546d3cf
-    // step(edge,x) : x < edge ? 0 : 1
-
-	vec3 boxMin = cubePosition - size / 2.0;
-	vec3 boxMax = cubePosition + size / 2.0;
-
-	vec3 center = (boxMax + boxMin) * 0.5;
-	vec3 boxSize = (boxMax - boxMin) * 0.5;
-	vec3 pc = surfacePosition - center;
-	// step(edge,x) : x < edge ? 0 : 1
-	vec3 normal = vec3(0.0);
-	normal += vec3(sign(pc.x), 0.0, 0.0) * step(abs(abs(pc.x) - boxSize.x), EPSILON);
-	normal += vec3(0.0, sign(pc.y), 0.0) * step(abs(abs(pc.y) - boxSize.y), EPSILON);
-	normal += vec3(0.0, 0.0, sign(pc.z)) * step(abs(abs(pc.z) - boxSize.z), EPSILON);
-	return normalize(normal);
-}
+	int shadowRays = max(u_shadowRays, 1);
+	for (int i = 0; i<shadowRays; i++) {
+		float lightChance;
+		int lightIndex = selectLight(point.position, i+seed, lightChance);
+		if (lightIndex < 0) continue;
+		PointLight light = getLight(lightIndex);
 
-bool planeIntersection(vec3 planeNormal, vec3 planePoint, Ray ray, out float hitDistance) 
-{ 
-    float denom = dot(planeNormal, ray.direction); 
-    if (abs(denom) > EPSILON) { 
-        vec3 d = planePoint - ray.origin; 
-        hitDistance = dot(d, planeNormal) / denom; 
-        return (hitDistance >= EPSILON); 
-    } 
- 
-    return false; 
-} 
-
-bool raycast(Ray ray, out SurfacePoint hitPoint) {
-	bool didHit = false;
-	float minHitDist = RENDER_DISTANCE;
-
-	float hitDist;
-	for (int i = 0; i<u_objects.length(); i++) {
-		if (u_objects[i].type == 0) continue;
-
-		if (u_objects[i].type == 1 && sphereIntersection(u_objects[i].position, u_objects[i].scale.x, ray, hitDist)) {
-			didHit = true;
-			if (hitDist < minHitDist) {
-				minHitDist = hitDist;
-				hitPoint.position = ray.origin + ray.direction * minHitDist;
-				hitPoint.normal = normalize(hitPoint.position - u_objects[i].position);
-				hitPoint.material = u_objects[i].material;
-			}
-		}
+		vec3 diffuseTerm, highlightTerm;
+		if (pointLightTerms(light, point, observerPos, diffuseTerm, highlightTerm)) {
+			vec3 receivedLight = highlightTerm;
 
-		if (u_objects[i].type == 2 && boxIntersection(u_objects[i].position, u_objects[i].scale, ray, hitDist)) {
-			didHit = true;
-			if (hitDist < minHitDist) {
-				minHitDist = hitDist;
-				hitPoint.position = ray.origin + ray.direction * minHitDist;
-				hitPoint.normal = boxNormal(u_objects[i].position, u_objects[i].scale, ray.origin + ray.direction * minHitDist);
-				hitPoint.material = u_objects[i].material;
+			// Shadow raycasting
+			vec3 lightDir;
+			float lightSurfaceDistance = sampleSphereCone(light.position, light.radius, point.position, i+seed, lightDir);
+			float cosine = dot(point.normal, lightDir);
+			if (cosine > 0.0) {
+				vec3 rayOrigin = point.position + lightDir * EPSILON * 2.0;
+				if (!occluded(Ray(rayOrigin, lightDir), lightSurfaceDistance - EPSILON * 2.0)) receivedLight += diffuseTerm * cosine;
 			}
-		}
-	}
 
-	if (u_planeVisible && planeIntersection(vec3(0,1,0), vec3(0, 0, 0), ray, hitDist)) {
-		didHit = true;
-		if (hitDist < minHitDist) {
-			minHitDist = hitDist;
-			hitPoint.position = ray.origin + ray.direction * minHitDist;
-			hitPoint.normal = vec3(0,1,0);
-			hitPoint.material = u_planeMaterial;
+			directIllumination += receivedLight / lightChance;
 		}
 	}
 
-	return didHit;
+	return directIllumination / shadowRays;
 }
 
-// Adapted from https://bitbucket.org/Daerst/gpu-ray-tracing-in-unity/src/Tutorial_Pt2/Assets/RayTracingShader.compute
-mat3x3 getTangentSpace(vec3 normal)
-{
-    // Choose a helper vector for the cross product
-    vec3 helper = vec3(1, 0, 0);
-    if (abs(normal.x) > 0.99)
-        helper = vec3(0, 0, 1);
-
-    // Generate vectors
-    vec3 tangent = normalize(cross(normal, helper));
-    vec3 binormal = normalize(cross(normal, tangent));
-    return mat3x3(tangent, binormal, normal);
+// Whether an edit changed what the pixel shows, see u_resetRegion
+bool insideResetRegion(ivec2 pixel) {
+	return all(greaterThanEqual(pixel, u_resetRegion.xy)) && all(lessThan(pixel, u_resetRegion.zw));
 }
 
-// Basic rejection sampling method
-vec3 _sampleHemisphere(vec3 normal, vec2 seed)
-{
-    vec3 vec = normalize(vec3(rand(seed)*2.0-1.0,rand(seed.yx+vec2(1.123123123,2.545454))*2.0-1.0,rand(seed-vec2(9.21428,7.43163431))*2.0-1.0));
-	if (dot(vec, normal) < 0.0) vec *= -1; 
-
-	return vec;
-}
-
-// Adapted from https://bitbucket.org/Daerst/gpu-ray-tracing-in-unity/src/Tutorial_Pt2/Assets/RayTracingShader.compute
-vec3 sampleHemisphere(vec3 normal, float alpha, vec2 seed)
-{
-    // Sample the hemisphere, where alpha determines the kind of the sampling
-    float cosTheta = pow(rand(seed), 1.0 / (alpha + 1.0));
-    float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
-    float phi = 2 * PI * rand(seed.yx);
-    vec3 tangentSpaceDir = vec3(cos(phi) * sinTheta, sin(phi) * sinTheta, cosTheta);
-
-    // Transform direction to world space
-    return getTangentSpace(normal) * tangentSpaceDir;
-}
+// Finds the pixel of the rendered area through which the previous camera saw the given direction. Inverse of generateCameraRay without jitter.
+bool previousPixel(vec3 direction, out ivec2 pixel) {
+	vec3 viewDirection = (u_previousRotationMatrix * vec4(direction, 0.0)).xyz;
+	if (viewDirection.z >= 0.0) return false;
 
-vec3 sampleSkybox(vec3 dir) {
-	if (u_skyboxStrength == 0.0) return vec3(0.0);
-	
-	return min(vec3(u_skyboxCeiling), u_skyboxStrength*pow(texture(u_skyboxTexture, vec2(0.5 + atan(dir.x, dir.z)/(2*PI), 0.5 + asin(-dir.y)/PI)).xyz, vec3(1.0/u_skyboxGamma)));
+	vec2 uv = (viewDirection.xy / -viewDirection.z / vec2(u_aspectRatio, 1.0) + vec2(1)) / 2;
+	vec2 renderSize = u_renderScale * vec2(textureSize(u_geometryTexture, 0));
+	pixel = ivec2(floor(uv * renderSize));
+	return all(greaterThanEqual(pixel, ivec2(0))) && all(lessThan(pixel, ivec2(renderSize)));
 }
 
-// Adds up the total light received directly from all light sources
-vec3 computeDirectIllumination(SurfacePoint point, vec3 observerPos, float seed) {
-	vec3 directIllumination = vec3(0);
-
-	for (int lightIndex = 0; lightIndex<u_lights.length(); lightIndex++) {
-		PointLight light = u_lights[lightIndex];
-			
-		float lightDistance = length(light.position - point.position);
-		if (lightDistance > light.reach) continue;
-
-		float diffuse = clamp(dot(point.normal, normalize(light.position-point.position)), 0.0, 1.0);
+// Warps the accumulation of the previous view into the current one. A pixel keeps the history of the pixel that saw the same surface
+// (same normal, same depth) or the same part of the sky, and starts over otherwise.
+void reprojectAccumulation() {
+	Ray cameraRay = generateCameraRay(fragUV, false, u_time);
+	Hit hit = closestHit(cameraRay);
+	fragObjectId = hit.objectIndex;
+	SurfacePoint hitPoint;
+	if (hit.objectIndex != NO_HIT) {
+		hitPoint = resolveHit(cameraRay, hit);
+		fragGeometry = vec4(hitPoint.normal, hit.distance);
+	} else {
+		fragGeometry = vec4(0);
+	}
 
-		if (diffuse > EPSILON || point.material.roughness < 1.0) {
-			// Shadow raycasting
-			int shadowRays = int(u_shadowResolution*light.radius*light.radius/(lightDistance*lightDistance)+1); // There must be a better way to find the right amount of shadow rays
-			int shadowRayHits = 0;
-			for (int i = 0; i<shadowRays; i++) {
-				// Sample a point on the light sphere
-				
-				vec3 lightSurfacePoint = light.position + normalize(vec3(rand(vec2(i+seed, 1)+point.position.xy), rand(vec2(i+seed, 2)+point.position.yz), rand(vec2(i+seed, 3)+point.position.xz))) * light.radius;
-				vec3 lightDir = normalize(lightSurfacePoint - point.position);
-				vec3 rayOrigin = point.position + lightDir * EPSILON * 2.0;
-				float maxRayLength = length(lightSurfacePoint - rayOrigin);
-				Ray shadowRay = Ray(rayOrigin, lightDir);
-				SurfacePoint SR_hit;
-				if (raycast(shadowRay, SR_hit)) {
-					if (length(SR_hit.position-rayOrigin) < maxRayLength) {
-						shadowRayHits += 1;
-					}
-				}
+	fragColor = vec4(0);
+	fragMoments = vec4(0);
 
-			}
+	ivec2 pixel = ivec2(gl_FragCoord.xy);
+	if (!u_historyValid || insideResetRegion(pixel)) return;
+	if (u_cameraUnchanged) {
+		fragColor = texelFetch(u_screenTexture, pixel, 0);
+		fragMoments = texelFetch(u_momentsTexture, pixel, 0);
+		return;
+	}
 
-			// Diffuse 
-			float attenuation = lightDistance * lightDistance;
-			directIllumination += light.color * light.power * diffuse * point.material.albedo * (1.0-float(shadowRayHits)/shadowRays) / attenuation;
-		
-			// Specular highlight
-			vec3 lightDir = normalize(point.position - light.position);
-			vec3 reflectedLightDir = reflect(lightDir, point.normal);
-			vec3 cameraDir = normalize(observerPos - point.position);
-			directIllumination += point.material.specularHighlight * light.color * (light.power/(lightDistance*lightDistance)) * pow(max(dot(cameraDir, reflectedLightDir), 0.0), 1.0/max(point.material.specularExponent, EPSILON));
-	
-		}
+	vec3 previousDirection = hit.objectIndex != NO_HIT ? hitPoint.position - u_previousCameraPosition : cameraRay.direction;
+	if (!previousPixel(normalize(previousDirection), pixel)) return;
+
+	vec4 previousGeometry = texelFetch(u_geometryTexture, pixel, 0);
+	if (hit.objectIndex != NO_HIT) {
+		if (previousGeometry.w <= 0.0 || dot(previousGeometry.xyz, hitPoint.normal) < REPROJECTION_NORMAL_THRESHOLD) return;
+
+		// The surface the previous camera saw through the center of that pixel must lie on the same plane as the new hit
+		vec2 previousUV = (vec2(pixel) + vec2(0.5)) / (u_renderScale * vec2(textureSize(u_geometryTexture, 0)));
+		vec2 centeredUV = (previousUV * 2 - vec2(1)) * vec2(u_aspectRatio, 1.0);
+		vec3 previousRayDirection = (normalize(vec4(centeredUV, -1.0, 0.0)) * u_previousRotationMatrix).xyz;
+		vec3 previousPosition = u_previousCameraPosition + previousRayDirection * previousGeometry.w;
+		if (abs(dot(previousPosition - hitPoint.position, hitPoint.normal)) > REPROJECTION_DEPTH_TOLERANCE * hit.distance) return;
+	} else if (previousGeometry.w > 0.0) {
+		return;
 	}
 
-	return directIllumination;
+	// Moments are sums over the passes, so they are scaled down along with the history length
+	vec4 moments = texelFetch(u_momentsTexture, pixel, 0);
+	if (moments.z > u_maxHistory) moments.xyz *= u_maxHistory / moments.z;
+	fragColor = texelFetch(u_screenTexture, pixel, 0);
+	fragMoments = moments;
+}
+
+// Object seen through the given screen pixel, read from the rendered area of the accumulation targets
+int objectIdAt(vec2 screenPixel) {
+	ivec2 renderSize = ivec2(u_renderScale * vec2(textureSize(u_objectIdTexture, 0)));
+	return texelFetch(u_objectIdTexture, clamp(ivec2(screenPixel * u_renderScale), ivec2(0), renderSize - ivec2(1)), 0).r;
 }
 
 // Based on https://bitbucket.org/Daerst/gpu-ray-tracing-in-unity/src/Tutorial_Pt2/Assets/RayTracingShader.compute
@@ -287,52 +144,36 @@ vec3 computeSceneColor(Ray cameraRay, float seed) {
 	vec3 rayOrigin = cameraRay.origin;
 	vec3 rayDirection = cameraRay.direction;
 	vec3 energy = vec3(1.0);
+	float scatterPdf = 0.0; // Camera rays can't be sampled by next event estimation
 	for (int depth = 0; depth < u_lightBounces; depth++) {
-		SurfacePoint hitPoint;
-		if (raycast(Ray(rayOrigin, rayDirection), hitPoint)) {
-			// Part one: Hit object's emission
-			totalIllumination += energy * hitPoint.material.emission * hitPoint.material.emissionStrength;
+		Ray ray = Ray(rayOrigin, rayDirection);
+		Hit hit = closestHit(ray);
+		if (hit.objectIndex != NO_HIT) {
+			SurfacePoint hitPoint = resolveHit(ray, hit);
 
-			// Part two: Direct light (received directly from light sources)
+			// Part one: Hit object's emission. Emitters are also sampled in part two, so the two estimates are weighted against each other.
+			totalIllumination += energy * hitPoint.material.emission * hitPoint.material.emissionStrength * emissionWeight(hit.objectIndex, rayOrigin, scatterPdf, 1.0);
+
+			// Part two: Direct light (received directly from light sources and emissive objects)
 			totalIllumination += energy * computeDirectIllumination(hitPoint, rayOrigin, seed);
 
-			// Part three: Indirect light (other objects + skybox)
-			float specChance = dot(hitPoint.material.specular, vec3(1.0/3.0));
-			float diffChance = dot(hitPoint.material.albedo, vec3(1.0/3.0));
-
-			float sum = specChance + diffChance;
-			specChance /= sum;
-			diffChance /= sum;
-
-			// Roulette-select the ray's path
-			float roulette = rand(hitPoint.position.zx+vec2(hitPoint.position.y)+vec2(seed, depth));
-			if (roulette < specChance)
-			{
-				// Specular reflection
-				float smoothness = 1.0-hitPoint.material.roughness;
-				float alpha = pow(1000.0, smoothness*smoothness);
-				if (smoothness == 1.0) {
-					rayDirection = reflect(rayDirection, hitPoint.normal);
-				} else {
-					rayDirection = sampleHemisphere(reflect(rayDirection, hitPoint.normal), alpha, hitPoint.position.zx+vec2(hitPoint.position.y)+vec2(seed, depth));
-				}
-				rayOrigin = hitPoint.position + rayDirection * EPSILON;
-				float f = (alpha + 2) / (alpha + 1);
-				energy *= hitPoint.material.specular * clamp(dot(hitPoint.normal, rayDirection) * f, 0.0, 1.0);
+			Ray shadowRay;
+			float maxDistance;
+			vec3 emitterLight;
+			if (sampleEmitter(hitPoint, hit.objectIndex, rayDirection, seed, 1.0, shadowRay, maxDistance, emitterLight) && !occluded(shadowRay, maxDistance)) {
+				totalIllumination += energy * emitterLight;
 			}
-			else if (diffChance > 0 && roulette < specChance + diffChance)
-			{
-				// Diffuse reflection
-				rayOrigin = hitPoint.position + hitPoint.normal * EPSILON;
-				rayDirection = sampleHemisphere(hitPoint.normal, 1.0, hitPoint.position.zx+vec2(hitPoint.position.y)+vec2(seed, depth));
-				energy *= hitPoint.material.albedo * clamp(dot(hitPoint.normal, rayDirection), 0.0, 1.0);
-			} else {
-				// This means both the hit material's albedo and specular are totally black, so there won't be anymore light. We can stop here.
-				break;
+
+			vec3 skyboxLight;
+			if (sampleSkyboxLight(hitPoint, rayDirection, seed, 1.0, shadowRay, skyboxLight) && !occluded(shadowRay, RENDER_DISTANCE)) {
+				totalIllumination += energy * skyboxLight;
 			}
+
+			// Part three: Indirect light (other objects + skybox)
+			if (!scatter(hitPoint, rayOrigin, rayDirection, energy, scatterPdf, seed, depth)) break;
 		} else {
-			// The ray didn't hit anything, so we add the sky's color and we're done
-			totalIllumination += energy * sampleSkybox(rayDirection);
+			// The ray didn't hit anything, so we add the sky's color (weighted against sampling the skybox directly) and we're done
+			totalIllumination += energy * sampleSkybox(rayDirection) * skyboxWeight(rayDirection, scatterPdf, 1.0);
 			break;
 		}
 	}
@@ -341,57 +182,55 @@ vec3 computeSceneColor(Ray cameraRay, float seed) {
 }
 
 void main() {
-	vec2 centeredUV = (fragUV * 2 - vec2(1)) * vec2(u_aspectRatio, 1.0);
-
 	if (u_directOutputPass) {
-		vec3 rayDir = (normalize(vec4(centeredUV, -1.0, 0.0)) * u_rotationMatrix).xyz;
-		Ray cameraRay = Ray(u_cameraPosition, rayDir);
-
-		fragColor = texture(u_screenTexture, fragUV);
-		float divider = float(u_accumulatedPasses);
-		fragColor.x /= divider;
-		fragColor.y /= divider;
-		fragColor.z /= divider;
-
-		// Selected object outline rendering
-		if (u_selectedSphereIndex >= 0) {
-			float hitDist;
-
-			float selectedSphereDist = length(u_objects[u_selectedSphereIndex].position - u_cameraPosition);
-
-			// Check if this camera ray is hitting the outline
-			Object selectedObject = u_objects[u_selectedSphereIndex];
-			if (selectedObject.type == 1 && sphereIntersection(selectedObject.position, selectedObject.scale[0]+OUTLINE_WIDTH*selectedSphereDist, cameraRay, hitDist)) {
-				if (!sphereIntersection(selectedObject.position, selectedObject.scale[0], cameraRay, hitDist)) {
-					fragColor = OUTLINE_COLOR;
-				}
-			} else if (selectedObject.type == 2 && boxIntersection(selectedObject.position, selectedObject.scale+vec3(OUTLINE_WIDTH*selectedSphereDist), cameraRay, hitDist)) {
-				if (!boxIntersection(selectedObject.position, selectedObject.scale, cameraRay, hitDist)) {
-					fragColor = OUTLINE_COLOR;
+		// Upscale the rendered area, without filtering in texels from outside of it
+		vec2 targetSize = vec2(textureSize(u_screenTexture, 0));
+		vec2 uv = clamp(fragUV * u_renderScale, vec2(0.5) / targetSize, (u_renderScale * targetSize - vec2(0.5)) / targetSize);
+		fragColor = texture(u_screenTexture, uv);
+		if (u_bloomIntensity > 0.0) fragColor.rgb += texture(u_bloomTexture, fragUV).rgb;
+
+		// Selected object outline rendering: pixels that don't see the selected object but have a neighbor that does
+		if (u_selectedSphereIndex >= 0 && u_selectedSphereIndex < u_objectCount && objectIdAt(gl_FragCoord.xy) != u_selectedSphereIndex) {
+			bool outline = false;
+			for (int y = -OUTLINE_WIDTH; y <= OUTLINE_WIDTH && !outline; y++) {
+				for (int x = -OUTLINE_WIDTH; x <= OUTLINE_WIDTH && !outline; x++) {
+					outline = objectIdAt(gl_FragCoord.xy + vec2(x, y)) == u_selectedSphereIndex;
 				}
 			}
+			if (outline) fragColor = OUTLINE_COLOR;
 		}
+	} else if (u_reprojectionPass) {
+		reprojectAccumulation();
 	} else {
-		if (u_blur > 0.0 && u_accumulatedPasses > 0) centeredUV += vec2(rand(vec2(1, u_time)+fragUV.xy)*u_blur-u_blur/2, rand(vec2(2, u_time)+fragUV.yx)*u_blur-u_blur/2);
-		vec3 rayDir = (normalize(vec4(centeredUV, -1.0, 0.0)) * u_rotationMatrix).xyz;
-		Ray cameraRay = Ray(u_cameraPosition, rayDir);
+		fragGeometry = texelFetch(u_geometryTexture, ivec2(gl_FragCoord.xy), 0);
+		fragObjectId = texelFetch(u_objectIdTexture, ivec2(gl_FragCoord.xy), 0).r;
+
+		bool reset = u_accumulatedPasses == 0;
+		vec4 moments = reset ? vec4(0) : texelFetch(u_momentsTexture, ivec2(gl_FragCoord.xy), 0);
+		if (pixelConverged(moments)) {
+			// Keep what was accumulated so far and leave the rays to the noisier pixels
+			fragColor = texelFetch(u_screenTexture, ivec2(gl_FragCoord.xy), 0);
+			fragMoments = moments;
+			atomicAdd(u_convergedPixels, 1);
+			return;
+		}
 
+		Ray cameraRay = generateCameraRay(fragUV, u_accumulatedPasses > 0, u_time);
 		// Camera raycasting
-		vec3 colorSum = computeSceneColor(cameraRay, u_time);
-		for (int i = 0; i<u_framePasses-1; i++) colorSum += computeSceneColor(cameraRay, u_time+i);
-		fragColor = vec4(colorSum / u_framePasses, 1.0);
-
+		vec3 colorSum = vec3(0);
+		vec2 luminanceSum = vec2(0);
+		for (int i = 0; i<u_framePasses; i++) {
+			vec3 color = computeSceneColor(cameraRay, u_time+i);
+			float colorLuminance = luminance(color);
+			colorSum += color;
+			luminanceSum += vec2(colorLuminance, colorLuminance * colorLuminance);
+		}
+		vec3 passColor = colorSum / u_framePasses;
+		fragMoments = moments + vec4(luminanceSum / u_framePasses, 1.0, 0.0);
 
-		if (u_accumulatedPasses > 0) {
-			// Bloom
-			SurfacePoint hitPoint;
-			vec3 offsetDirection = cameraRay.direction + vec3(rand(vec2(1, u_time)+fragUV)*u_bloomRadius-u_bloomRadius/2, rand(vec2(2, u_time)+fragUV)*u_bloomRadius-u_bloomRadius/2, rand(vec2(3, u_time)+fragUV)*u_bloomRadius-u_bloomRadius/2);
-			if (raycast(Ray(cameraRay.origin, offsetDirection), hitPoint)) {
-				fragColor += vec4(hitPoint.material.emission*hitPoint.material.emissionStrength*u_bloomIntensity, 1.0);
-			}
+		vec3 previousColor = reset ? vec3(0) : texelFetch(u_screenTexture, ivec2(gl_FragCoord.xy), 0).rgb;
 
-			// Add last frame back (progressive sampling)
-			fragColor += texture(u_screenTexture, fragUV);
-		}
+		// Progressive sampling. The target holds a running mean rather than a sum, so that half-float targets keep their precision.
+		fragColor = vec4(accumulationColor(previousColor + (passColor - previousColor) / fragMoments.z, fragUV + vec2(u_time)), 1.0);
 	}
 }
\ No newline at end of file
@@ -0,0 +1,98 @@
+#include "accumulation.h"
+
+#include <iostream>
+
+namespace Accumulation {
+	bool packed = false;
+	GLuint colorTextures[2], momentsTextures[2], framebuffers[2];
+	GLuint geometryTextures[2];
+	GLuint objectIdTextures[2];
+	int current = 0;
+	int width = 0, height = 0;
+
+	GLenum colorFormat() {
+		return packed ? GL_RGBA16F : GL_RGBA32F;
+	}
+
+	void allocateTexture(GLuint texture, GLenum format, GLint filter) {
+		bool integer = format == GL_R32I;
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, integer ? GL_RED_INTEGER : GL_RGBA, integer ? GL_INT : GL_FLOAT, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+	}
+
+	// (Re)creates both targets at the given size and in the current format. Their content is undefined until the next pass with 0 accumulated passes.
+	void allocate(int newWidth, int newHeight) {
+		if (!framebuffers[0]) {
+			glGenTextures(2, colorTextures);
+			glGenTextures(2, momentsTextures);
+			glGenTextures(2, geometryTextures);
+			glGenTextures(2, objectIdTextures);
+			glGenFramebuffers(2, framebuffers);
+		}
+
+		width = newWidth;
+		height = newHeight;
+
+		// Unit 0 is about to be rebound to the current target anyway, while other units hold textures that must be left alone
+		glActiveTexture(GL_TEXTURE0);
+		for (int i = 0; i < 2; i++) {
+			allocateTexture(colorTextures[i], colorFormat(), GL_LINEAR);
+			allocateTexture(momentsTextures[i], GL_RGBA32F, GL_NEAREST);
+			allocateTexture(geometryTextures[i], GL_RGBA32F, GL_NEAREST);
+			allocateTexture(objectIdTextures[i], GL_R32I, GL_NEAREST);
+
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i]);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTextures[i], 0);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, momentsTextures[i], 0);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, geometryTextures[i], 0);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, objectIdTextures[i], 0);
+			const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2, GL_COLOR_ATTACHMENT3 };
+			glDrawBuffers(4, drawBuffers);
+
+			if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+				std::cout << "ERROR: Accumulation framebuffer is not complete!" << std::endl;
+			}
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+		current = 0;
+		bindCurrent();
+	}
+
+	// Binds the current target's textures to the units the shaders read the accumulation from
+	void bindCurrent() {
+		glActiveTexture(GL_TEXTURE7);
+		glBindTexture(GL_TEXTURE_2D, objectIdTextures[current]);
+		glActiveTexture(GL_TEXTURE5);
+		glBindTexture(GL_TEXTURE_2D, geometryTextures[current]);
+		glActiveTexture(GL_TEXTURE4);
+		glBindTexture(GL_TEXTURE_2D, momentsTextures[current]);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, colorTextures[current]);
+	}
+
+	// Makes the draws that follow read the current target and render into the other one
+	void beginPass() {
+		bindCurrent();
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[1 - current]);
+	}
+
+	// Makes the target that was just rendered into the current one
+	void endPass() {
+		current = 1 - current;
+		bindCurrent();
+	}
+
+	void cleanup() {
+		if (!framebuffers[0]) return;
+
+		glDeleteFramebuffers(2, framebuffers);
+		glDeleteTextures(2, colorTextures);
+		glDeleteTextures(2, momentsTextures);
+		glDeleteTextures(2, geometryTextures);
+		glDeleteTextures(2, objectIdTextures);
+		framebuffers[0] = framebuffers[1] = 0;
+	}
+}
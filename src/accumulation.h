@@ -0,0 +1,21 @@
+#pragma once
+
+#include <GL/glew.h>
+
+// Double-buffered accumulation targets. Every pass reads the current target (color on texture unit 0, luminance moments on unit 4,
+// primary hit geometry on unit 5, primary hit object IDs on unit 7) and renders into the other one, which then becomes current. No texture is ever sampled while it is being rendered to.
+namespace Accumulation {
+	extern bool packed; // Store color in RGBA16F instead of RGBA32F. The moments stay in RGBA32F so that pass counts remain exact.
+	extern GLuint colorTextures[2], momentsTextures[2], framebuffers[2];
+	extern GLuint geometryTextures[2]; // Normal and distance of the surface seen through each pixel, written by the reprojection pass and copied by the others
+	extern GLuint objectIdTextures[2]; // Index of the object seen through each pixel (NO_HIT or PLANE_HIT otherwise), written and copied like the geometry
+	extern int current; // Index of the target holding the latest accumulation
+	extern int width, height;
+
+	GLenum colorFormat();
+	void allocate(int width, int height);
+	void bindCurrent();
+	void beginPass();
+	void endPass();
+	void cleanup();
+}
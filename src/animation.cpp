@@ -13,6 +13,9 @@ namespace Animation {
 
 	int framePasses = 16;
 	int frameRate = 24;
+	ImageFormat outputFormat = FORMAT_PNG;
+	StreamFormat streamFormat = STREAM_Y4M;
+	char streamTarget[256] = "-";
 
 	void setStartPosition(glm::vec3 cameraPos, float cameraYaw, float cameraPitch) {
 		positionA = cameraPos;
@@ -2,6 +2,9 @@
 
 #include <glm/gtc/matrix_transform.hpp>
 
+#include "imagewriter.h"
+#include "framestream.h"
+
 namespace Animation {
 	extern bool currentlyRenderingAnimation;
 	extern int currentFrame;
@@ -15,6 +18,9 @@ namespace Animation {
 
 	extern int framePasses; // How many times a frame should be rendered before the combined result is saved to disk.
 	extern int frameRate;
+	extern ImageFormat outputFormat; // Format of the saved frames
+	extern StreamFormat streamFormat; // Used when outputFormat is FORMAT_STREAM
+	extern char streamTarget[256]; // Named pipe, or "-" for stdout
 
 	void setStartPosition(glm::vec3 cameraPos, float cameraYaw, float cameraPitch);
 	void setEndPosition(glm::vec3 cameraPos, float cameraYaw, float cameraPitch);
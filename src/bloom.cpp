@@ -0,0 +1,110 @@
+#include "bloom.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "scene.h"
+#include "accumulation.h"
+#include "shader.h"
+
+#define MODE_PREFILTER 0
+#define MODE_DOWNSAMPLE 1
+#define MODE_UPSAMPLE 2
+
+namespace Bloom {
+	int levelCount = 0;
+
+	GLuint program;
+	GLuint textures[BLOOM_MAX_LEVELS], framebuffers[BLOOM_MAX_LEVELS];
+	int widths[BLOOM_MAX_LEVELS], heights[BLOOM_MAX_LEVELS];
+	int allocatedWidth = 0, allocatedHeight = 0;
+
+	// Level i is 2^(i+1) times smaller than the accumulation targets
+	void allocate(int width, int height) {
+		if (!framebuffers[0]) {
+			glGenTextures(BLOOM_MAX_LEVELS, textures);
+			glGenFramebuffers(BLOOM_MAX_LEVELS, framebuffers);
+		}
+
+		glActiveTexture(GL_TEXTURE0 + BLOOM_TEXTURE_UNIT);
+		for (int i = 0; i < BLOOM_MAX_LEVELS; i++) {
+			widths[i] = std::max(width >> (i + 1), 1);
+			heights[i] = std::max(height >> (i + 1), 1);
+
+			glBindTexture(GL_TEXTURE_2D, textures[i]);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, widths[i], heights[i], 0, GL_RGBA, GL_FLOAT, NULL);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+			glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i]);
+			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, textures[i], 0);
+		}
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glActiveTexture(GL_TEXTURE0);
+
+		allocatedWidth = width;
+		allocatedHeight = height;
+	}
+
+	// Draws the given source texture into a level with one of the filters of bloom.glsl
+	void filter(int mode, GLuint source, int level) {
+		glActiveTexture(GL_TEXTURE0 + BLOOM_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D, source);
+		glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[level]);
+		glViewport(0, 0, widths[level], heights[level]);
+		glUniform1i(glGetUniformLocation(program, "u_mode"), mode);
+		glDrawArrays(GL_TRIANGLES, 0, 6);
+	}
+
+	// renderScaleX/Y are the part of the accumulation targets the last passes covered, see u_renderScale.
+	// Leaves the framebuffer and the viewport to be set by the caller.
+	void render(float renderScaleX, float renderScaleY) {
+		if (Scene::bloomIntensity <= 0.0f) {
+			levelCount = 0;
+			return;
+		}
+
+		GLint previousProgram;
+		glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+
+		if (!program) program = createShaderProgram("shaders/vertex.glsl", "shaders/bloom.glsl");
+		if (Accumulation::width != allocatedWidth || Accumulation::height != allocatedHeight) allocate(Accumulation::width, Accumulation::height);
+
+		// Each level doubles how far the glow reaches. The radius is relative to the screen height, like the blur of the camera.
+		float radiusPixels = Scene::bloomRadius * Accumulation::height / 2.0f;
+		levelCount = std::max(1, std::min(BLOOM_MAX_LEVELS, (int)std::ceil(std::log2(std::max(radiusPixels, 2.0f)))));
+
+		glUseProgram(program);
+		glUniform1i(glGetUniformLocation(program, "u_sourceTexture"), BLOOM_TEXTURE_UNIT);
+		glUniform2f(glGetUniformLocation(program, "u_sourceScale"), renderScaleX, renderScaleY);
+		glUniform1f(glGetUniformLocation(program, "u_threshold"), Scene::bloomThreshold);
+		glUniform1f(glGetUniformLocation(program, "u_strength"), Scene::bloomIntensity / levelCount); // Every level is added to the result
+
+		filter(MODE_PREFILTER, Accumulation::colorTextures[Accumulation::current], 0);
+		glUniform2f(glGetUniformLocation(program, "u_sourceScale"), 1.0f, 1.0f);
+		for (int i = 1; i < levelCount; i++) filter(MODE_DOWNSAMPLE, textures[i - 1], i);
+
+		glEnable(GL_BLEND);
+		glBlendFunc(GL_ONE, GL_ONE);
+		for (int i = levelCount - 1; i > 0; i--) filter(MODE_UPSAMPLE, textures[i], i - 1);
+		glDisable(GL_BLEND);
+
+		glActiveTexture(GL_TEXTURE0 + BLOOM_TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_2D, textures[0]);
+		glActiveTexture(GL_TEXTURE0);
+		glUseProgram(previousProgram);
+	}
+
+	void cleanup() {
+		if (program) glDeleteProgram(program);
+		program = 0;
+
+		if (!framebuffers[0]) return;
+		glDeleteFramebuffers(BLOOM_MAX_LEVELS, framebuffers);
+		glDeleteTextures(BLOOM_MAX_LEVELS, textures);
+		framebuffers[0] = 0;
+		allocatedWidth = allocatedHeight = 0;
+	}
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#define BLOOM_MAX_LEVELS 8
+#define BLOOM_TEXTURE_UNIT 6
+
+// Post-process bloom, computed from the accumulation once per displayed frame instead of once per pass, so it costs no ray and
+// changing it doesn't discard any sample. The parts of the image brighter than Scene::bloomThreshold are downsampled through a chain
+// of half-size targets, then upsampled back to the first one while every level is added. Scene::bloomRadius picks the number of levels.
+// The result is bound to texture unit BLOOM_TEXTURE_UNIT, where the display pass adds it to the image.
+namespace Bloom {
+	extern int levelCount; // Levels used by the last render
+
+	void render(float renderScaleX, float renderScaleY);
+	void cleanup();
+}
@@ -0,0 +1,212 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <limits>
+#include <glm/glm.hpp>
+
+namespace BVH {
+	std::vector<Node> nodes;
+	std::vector<int> primitiveIndices;
+	GLuint nodeBuffer, primitiveBuffer;
+
+	struct Bounds {
+		glm::vec3 min = glm::vec3(std::numeric_limits<float>::max());
+		glm::vec3 max = glm::vec3(-std::numeric_limits<float>::max());
+
+		void grow(glm::vec3 point) {
+			min = glm::min(min, point);
+			max = glm::max(max, point);
+		}
+
+		void grow(const Bounds& other) {
+			min = glm::min(min, other.min);
+			max = glm::max(max, other.max);
+		}
+
+		// Half the surface area, which is all the SAH needs
+		float area() const {
+			glm::vec3 extent = max - min;
+			if (extent.x < 0.0f) return 0.0f;
+			return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+		}
+	};
+
+	// Per-object data used during the build, indexed by object index
+	std::vector<Bounds> primitiveBounds;
+	std::vector<glm::vec3> centroids;
+
+	Bounds objectBounds(const Scene::Object& object) {
+		glm::vec3 position(object.position[0], object.position[1], object.position[2]);
+		glm::vec3 extent = object.type == 1 ? glm::vec3(object.scale[0]) : glm::vec3(object.scale[0], object.scale[1], object.scale[2]) / 2.0f;
+		extent = glm::abs(extent);
+
+		Bounds bounds;
+		bounds.min = position - extent;
+		bounds.max = position + extent;
+		return bounds;
+	}
+
+	Bounds nodeBounds(const Node& node) {
+		Bounds bounds;
+		bounds.min = glm::vec3(node.boundsMin[0], node.boundsMin[1], node.boundsMin[2]);
+		bounds.max = glm::vec3(node.boundsMax[0], node.boundsMax[1], node.boundsMax[2]);
+		return bounds;
+	}
+
+	void setNodeBounds(Node& node, const Bounds& bounds) {
+		for (int i = 0; i < 3; i++) {
+			node.boundsMin[i] = bounds.min[i];
+			node.boundsMax[i] = bounds.max[i];
+		}
+	}
+
+	int binIndex(float centroid, float binMin, float binScale) {
+		return std::min(BVH_BIN_COUNT - 1, (int)((centroid - binMin) * binScale));
+	}
+
+	// Splits a leaf in two using the binned surface area heuristic, or leaves it as is if no split is cheaper than intersecting all of its primitives
+	void subdivide(int nodeIndex, int depth) {
+		int first = nodes[nodeIndex].leftFirst;
+		int count = nodes[nodeIndex].primitiveCount;
+
+		Bounds bounds, centroidBounds;
+		for (int i = first; i < first + count; i++) {
+			bounds.grow(primitiveBounds[primitiveIndices[i]]);
+			centroidBounds.grow(centroids[primitiveIndices[i]]);
+		}
+		setNodeBounds(nodes[nodeIndex], bounds);
+
+		if (count <= 1 || depth >= BVH_MAX_DEPTH) return;
+
+		// Costs are relative to one primitive intersection, with traversing a node costing about as much
+		float bestCost = count * bounds.area();
+		int bestAxis = -1, bestSplit = 0;
+		for (int axis = 0; axis < 3; axis++) {
+			float binMin = centroidBounds.min[axis];
+			float binMax = centroidBounds.max[axis];
+			if (binMax <= binMin) continue;
+
+			float binScale = BVH_BIN_COUNT / (binMax - binMin);
+			Bounds bins[BVH_BIN_COUNT];
+			int binCounts[BVH_BIN_COUNT] = { 0 };
+			for (int i = first; i < first + count; i++) {
+				int objectIndex = primitiveIndices[i];
+				int bin = binIndex(centroids[objectIndex][axis], binMin, binScale);
+				binCounts[bin]++;
+				bins[bin].grow(primitiveBounds[objectIndex]);
+			}
+
+			// Sweep from both ends so every split plane is evaluated in linear time
+			float leftAreas[BVH_BIN_COUNT - 1], rightAreas[BVH_BIN_COUNT - 1];
+			int leftCounts[BVH_BIN_COUNT - 1], rightCounts[BVH_BIN_COUNT - 1];
+			Bounds leftBounds, rightBounds;
+			int leftSum = 0, rightSum = 0;
+			for (int i = 0; i < BVH_BIN_COUNT - 1; i++) {
+				leftSum += binCounts[i];
+				leftBounds.grow(bins[i]);
+				leftCounts[i] = leftSum;
+				leftAreas[i] = leftBounds.area();
+
+				rightSum += binCounts[BVH_BIN_COUNT - 1 - i];
+				rightBounds.grow(bins[BVH_BIN_COUNT - 1 - i]);
+				rightCounts[BVH_BIN_COUNT - 2 - i] = rightSum;
+				rightAreas[BVH_BIN_COUNT - 2 - i] = rightBounds.area();
+			}
+
+			for (int i = 0; i < BVH_BIN_COUNT - 1; i++) {
+				if (leftCounts[i] == 0 || rightCounts[i] == 0) continue;
+
+				float cost = bounds.area() + leftCounts[i] * leftAreas[i] + rightCounts[i] * rightAreas[i];
+				if (cost < bestCost) {
+					bestCost = cost;
+					bestAxis = axis;
+					bestSplit = i;
+				}
+			}
+		}
+
+		if (bestAxis == -1) return;
+
+		float binMin = centroidBounds.min[bestAxis];
+		float binScale = BVH_BIN_COUNT / (centroidBounds.max[bestAxis] - binMin);
+		auto middle = std::partition(primitiveIndices.begin() + first, primitiveIndices.begin() + first + count, [&](int objectIndex) {
+			return binIndex(centroids[objectIndex][bestAxis], binMin, binScale) <= bestSplit;
+		});
+		int leftCount = (int)(middle - (primitiveIndices.begin() + first));
+
+		int leftIndex = (int)nodes.size();
+		nodes.push_back(Node());
+		nodes.push_back(Node());
+		nodes[leftIndex].leftFirst = first;
+		nodes[leftIndex].primitiveCount = leftCount;
+		nodes[leftIndex + 1].leftFirst = first + leftCount;
+		nodes[leftIndex + 1].primitiveCount = count - leftCount;
+
+		nodes[nodeIndex].leftFirst = leftIndex;
+		nodes[nodeIndex].primitiveCount = 0;
+
+		subdivide(leftIndex, depth + 1);
+		subdivide(leftIndex + 1, depth + 1);
+	}
+
+	// Rebuilds the whole hierarchy from scratch. Invisible objects (type 0) are left out.
+	void build(const std::vector<Scene::Object>& objects) {
+		primitiveBounds.resize(objects.size());
+		centroids.resize(objects.size());
+		primitiveIndices.clear();
+		for (int i = 0; i < objects.size(); i++) {
+			if (objects[i].type == 0) continue;
+
+			primitiveBounds[i] = objectBounds(objects[i]);
+			centroids[i] = (primitiveBounds[i].min + primitiveBounds[i].max) * 0.5f;
+			primitiveIndices.push_back(i);
+		}
+
+		nodes.clear();
+		nodes.reserve(std::max<size_t>(primitiveIndices.size() * 2, 1));
+
+		Node root = Node();
+		root.leftFirst = 0;
+		root.primitiveCount = (int)primitiveIndices.size();
+		nodes.push_back(root);
+
+		// An empty tree is a root with no primitives and no children, which the shader checks for before traversing
+		if (primitiveIndices.empty()) return;
+
+		subdivide(0, 0);
+	}
+
+	// Recomputes the bounds of every node without changing the topology. Much cheaper than a rebuild when objects were only edited.
+	void refit(const std::vector<Scene::Object>& objects) {
+		// Children are always stored after their parent, so walking backwards updates them first
+		for (int i = (int)nodes.size() - 1; i >= 0; i--) {
+			Node& node = nodes[i];
+			Bounds bounds;
+			if (node.primitiveCount > 0) {
+				for (int j = node.leftFirst; j < node.leftFirst + node.primitiveCount; j++) bounds.grow(objectBounds(objects[primitiveIndices[j]]));
+			}
+			else if (node.leftFirst > 0) {
+				bounds.grow(nodeBounds(nodes[node.leftFirst]));
+				bounds.grow(nodeBounds(nodes[node.leftFirst + 1]));
+			}
+			else {
+				continue;
+			}
+
+			setNodeBounds(node, bounds);
+		}
+	}
+
+	void upload() {
+		if (!nodeBuffer) glGenBuffers(1, &nodeBuffer);
+		if (!primitiveBuffer) glGenBuffers(1, &primitiveBuffer);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, nodeBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, nodes.size() * sizeof(Node), nodes.data(), GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, nodeBuffer); // Binding 1 = BVHNodeBuffer in common.glsl
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, primitiveBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(primitiveIndices.size(), 1) * sizeof(int), primitiveIndices.empty() ? nullptr : primitiveIndices.data(), GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, primitiveBuffer); // Binding 2 = BVHPrimitiveBuffer in common.glsl
+	}
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <vector>
+
+#include "scene.h"
+
+#define BVH_MAX_DEPTH 32 // Must not exceed BVH_STACK_SIZE in common.glsl
+#define BVH_BIN_COUNT 16
+
+namespace BVH {
+	// Flattened node, uploaded as-is to the BVH node SSBO. Must match BVHNode in common.glsl.
+	struct Node {
+		float boundsMin[3];
+		int leftFirst; // Interior nodes: index of the left child (the right child directly follows it). Leaves: index of the first primitive.
+		float boundsMax[3];
+		int primitiveCount; // 0 for interior nodes
+	};
+
+	static_assert(sizeof(Node) == 8 * sizeof(float), "BVH::Node no longer matches the std430 layout of BVHNode");
+
+	extern std::vector<Node> nodes;
+	extern std::vector<int> primitiveIndices; // Object indices, ordered so that every leaf references a contiguous range
+	extern GLuint nodeBuffer, primitiveBuffer;
+
+	void build(const std::vector<Scene::Object>& objects);
+	void refit(const std::vector<Scene::Object>& objects);
+	void upload();
+}
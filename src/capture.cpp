@@ -0,0 +1,107 @@
+#include "capture.h"
+
+#include <iostream>
+#include <cstring>
+#include <utility>
+
+#include "accumulation.h"
+
+namespace Capture {
+	struct Readback {
+		GLuint buffer = 0;
+		GLsizeiptr capacity = 0;
+		GLsync fence = 0; // Set while the readback is in flight
+		int width = 0, height = 0;
+		std::string filepath;
+		ImageFormat format = FORMAT_PNG;
+		int frame = 0;
+	};
+
+	Readback ring[CAPTURE_RING_SIZE];
+	int next = 0; // Slot of the next readback, which is also the oldest one in flight if any
+
+	// Hands the readback to ImageWriter once its copy is done. Returns false if it isn't and wait is false.
+	bool finish(Readback& readback, bool wait) {
+		GLenum status = glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+		if (status == GL_TIMEOUT_EXPIRED) return false;
+		if (status == GL_WAIT_FAILED) std::cout << "ERROR: Waiting for the readback of " << readback.filepath << " failed" << std::endl;
+		glDeleteSync(readback.fence);
+		readback.fence = 0;
+
+		Image image;
+		image.width = readback.width;
+		image.height = readback.height;
+		image.filepath = readback.filepath;
+		image.format = readback.format;
+		image.frame = readback.frame;
+		image.pixels.resize((size_t)readback.width * readback.height * 3);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, image.pixels.size() * sizeof(float), GL_MAP_READ_BIT);
+		if (data) {
+			memcpy(image.pixels.data(), data, image.pixels.size() * sizeof(float));
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		if (data) ImageWriter::submit(std::move(image));
+		else std::cout << "ERROR: Could not map the readback of " << readback.filepath << std::endl;
+		return true;
+	}
+
+	// Starts copying the current accumulation target, to be written to filepath (or to the open stream) once it has arrived
+	void request(const std::string& filepath, ImageFormat format, int frame) {
+		Readback& readback = ring[next];
+		if (readback.fence) finish(readback, true);
+		if (!readback.buffer) glGenBuffers(1, &readback.buffer);
+
+		readback.width = Accumulation::width;
+		readback.height = Accumulation::height;
+		readback.filepath = filepath;
+		readback.format = format;
+		readback.frame = frame;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+		GLsizeiptr size = (GLsizeiptr)readback.width * readback.height * 3 * sizeof(float);
+		if (size > readback.capacity) {
+			glBufferData(GL_PIXEL_PACK_BUFFER, size, NULL, GL_STREAM_READ);
+			readback.capacity = size;
+		}
+
+		glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT); // The wavefront backend writes the targets with image stores
+		glPixelStorei(GL_PACK_ALIGNMENT, 4);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, Accumulation::framebuffers[Accumulation::current]);
+		glReadBuffer(GL_COLOR_ATTACHMENT0);
+		glReadPixels(0, 0, readback.width, readback.height, GL_RGB, GL_FLOAT, 0);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		next = (next + 1) % CAPTURE_RING_SIZE;
+	}
+
+	// Hands the readbacks that have arrived to ImageWriter, oldest first, without waiting for the others
+	void poll() {
+		for (int i = 0; i < CAPTURE_RING_SIZE; i++) {
+			Readback& readback = ring[(next + i) % CAPTURE_RING_SIZE];
+			if (readback.fence && !finish(readback, false)) break;
+		}
+	}
+
+	// Waits for every readback in flight and hands them to ImageWriter
+	void flush() {
+		for (int i = 0; i < CAPTURE_RING_SIZE; i++) {
+			Readback& readback = ring[(next + i) % CAPTURE_RING_SIZE];
+			if (readback.fence) finish(readback, true);
+		}
+	}
+
+	void cleanup() {
+		flush();
+		for (Readback& readback : ring) {
+			if (readback.buffer) glDeleteBuffers(1, &readback.buffer);
+			readback.buffer = 0;
+			readback.capacity = 0;
+		}
+	}
+}
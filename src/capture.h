@@ -0,0 +1,19 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <string>
+
+#include "imagewriter.h"
+
+#define CAPTURE_RING_SIZE 3 // Readbacks in flight at once. When all are in use, a new one first waits for the oldest.
+
+// Saves frames without stalling the GPU. The current accumulation target is copied into one of a ring of pixel buffer objects,
+// which is only mapped once a fence says the copy is done, usually a frame or two later, and then handed to ImageWriter's workers.
+// Frames are read from the accumulation rather than the screen, so they contain neither the GUI nor the bloom,
+// and don't depend on the window being visible.
+namespace Capture {
+	void request(const std::string& filepath, ImageFormat format, int frame = 0);
+	void poll();
+	void flush();
+	void cleanup();
+}
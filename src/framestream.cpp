@@ -0,0 +1,161 @@
+#include "framestream.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <vector>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#define dup _dup
+#define dup2 _dup2
+#define fdopen _fdopen
+#define fileno _fileno
+#define isatty _isatty
+#else
+#include <unistd.h>
+#endif
+
+namespace FrameStream {
+	const char* formatNames[STREAM_FORMAT_COUNT] = { "Raw RGB", "Raw RGBA", "Y4M" };
+
+	FILE* file = nullptr;
+	bool toStdout = false;
+	StreamFormat format = STREAM_RGB;
+	int frameRate = 24;
+	int width = 0, height = 0; // Of the first frame, which every other one must match
+	int nextFrame = 0;
+	std::map<int, std::vector<unsigned char>> waitingFrames; // Converted frames whose predecessors haven't been written yet
+	std::mutex mutex;
+	int stdoutHandle = -1; // The original stdout, once reserveStdout() has pointed stdout at stderr
+
+	bool stdoutIsTerminal() {
+		return isatty(fileno(stdout));
+	}
+
+	// Sets the original stdout aside for streams opened on "-", and points stdout at stderr for the rest of the run so that no message ends up in them.
+	// Must be called before anything is printed when a stream may go to stdout later on.
+	void reserveStdout() {
+		if (stdoutHandle != -1) return;
+
+		std::cout.flush();
+		fflush(stdout);
+		stdoutHandle = dup(fileno(stdout));
+		if (stdoutHandle != -1) dup2(fileno(stderr), fileno(stdout));
+	}
+
+	// target is the path of a named pipe (or of a plain file), or "-" for stdout
+	bool open(const std::string& target, StreamFormat streamFormat, int streamFrameRate) {
+		close();
+
+		toStdout = target == "-";
+		if (toStdout) {
+			reserveStdout();
+			int streamHandle = stdoutHandle != -1 ? dup(stdoutHandle) : -1; // Closing the stream mustn't close the reserved handle, another animation may stream to it
+			file = streamHandle != -1 ? fdopen(streamHandle, "wb") : nullptr;
+		}
+		else {
+			file = fopen(target.c_str(), "wb");
+		}
+		if (!file) {
+			std::cout << "ERROR: Could not open " << target << " for streaming" << std::endl;
+			return false;
+		}
+#ifdef _WIN32
+		_setmode(fileno(file), _O_BINARY);
+#endif
+
+		format = streamFormat;
+		frameRate = std::max(streamFrameRate, 1);
+		width = height = 0;
+		nextFrame = 0;
+		return true;
+	}
+
+	bool isOpen() {
+		return file != nullptr;
+	}
+
+	unsigned char toByte(float value) {
+		return (unsigned char)(std::min(std::max(value, 0.0f), 1.0f) * 255.0f + 0.5f);
+	}
+
+	// Converts a frame to the bytes the stream expects for it, header excluded, clamped to [0, 1] like the PNG output
+	std::vector<unsigned char> convert(const Image& image) {
+		size_t pixelCount = (size_t)image.width * image.height;
+		int channels = format == STREAM_RGBA ? 4 : 3;
+		std::vector<unsigned char> bytes(pixelCount * channels);
+
+		for (int y = 0; y < image.height; y++) {
+			const float* row = image.pixels.data() + (size_t)(image.height - 1 - y) * image.width * 3;
+			for (int x = 0; x < image.width; x++) {
+				size_t pixel = (size_t)y * image.width + x;
+				float r = row[x * 3], g = row[x * 3 + 1], b = row[x * 3 + 2];
+
+				if (format == STREAM_Y4M) {
+					// Planar Y, Cb and Cr, from the same 8-bit values as the other formats
+					float red = toByte(r) / 255.0f, green = toByte(g) / 255.0f, blue = toByte(b) / 255.0f;
+					bytes[pixel] = (unsigned char)(16.0f + 65.481f * red + 128.553f * green + 24.966f * blue + 0.5f);
+					bytes[pixelCount + pixel] = (unsigned char)(128.0f - 37.797f * red - 74.203f * green + 112.0f * blue + 0.5f);
+					bytes[2 * pixelCount + pixel] = (unsigned char)(128.0f + 112.0f * red - 93.786f * green - 18.214f * blue + 0.5f);
+				}
+				else {
+					unsigned char* destination = bytes.data() + pixel * channels;
+					destination[0] = toByte(r);
+					destination[1] = toByte(g);
+					destination[2] = toByte(b);
+					if (channels == 4) destination[3] = 255;
+				}
+			}
+		}
+		return bytes;
+	}
+
+	// Converts the frame on the calling worker, then writes it along with every frame that was only waiting for it
+	bool write(const Image& image) {
+		std::vector<unsigned char> bytes = convert(image);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!file) return false;
+
+		if (width == 0) {
+			width = image.width;
+			height = image.height;
+			if (format == STREAM_Y4M) fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, frameRate);
+		}
+		if (image.width != width || image.height != height) {
+			std::cout << "ERROR: Frame " << image.frame << " is " << image.width << "x" << image.height << " but the stream is " << width << "x" << height << std::endl;
+			bytes.clear(); // Still takes its place in the sequence, so that the next frames aren't held back forever
+		}
+
+		waitingFrames[image.frame] = std::move(bytes);
+		bool written = true;
+		for (auto next = waitingFrames.find(nextFrame); next != waitingFrames.end(); next = waitingFrames.find(nextFrame)) {
+			if (!next->second.empty()) {
+				if (format == STREAM_Y4M) fputs("FRAME\n", file);
+				written = fwrite(next->second.data(), 1, next->second.size(), file) == next->second.size() && written;
+			}
+			waitingFrames.erase(next);
+			nextFrame++;
+		}
+		fflush(file);
+
+		if (!written) std::cout << "ERROR: Could not write to the stream" << std::endl;
+		return written;
+	}
+
+	// Frames still waiting for a predecessor that never came are dropped
+	void close() {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!file) return;
+
+		if (!waitingFrames.empty()) std::cout << "ERROR: Frame " << nextFrame << " never reached the stream, " << waitingFrames.size() << " frames after it were dropped" << std::endl;
+		waitingFrames.clear();
+
+		fclose(file);
+		file = nullptr;
+	}
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+
+#include "imagewriter.h"
+
+enum StreamFormat {
+	STREAM_RGB, // Raw 8-bit RGB frames, rows from top to bottom, without any header
+	STREAM_RGBA, // Same with an opaque alpha channel
+	STREAM_Y4M, // YUV4MPEG2 with 4:4:4 BT.601 limited range frames
+	STREAM_FORMAT_COUNT
+};
+
+// Sink that writes every frame of a render to a single stream (stdout or a named pipe) instead of one file per frame,
+// so that an external encoder can consume them directly, e.g. ffmpeg -f yuv4mpegpipe -i - or -f rawvideo -pix_fmt rgb24 -s WxH -i -.
+// Frames carry their number (Image::frame) and are converted by ImageWriter's workers in any order, but reach the stream in sequence.
+namespace FrameStream {
+	extern const char* formatNames[STREAM_FORMAT_COUNT];
+
+	bool stdoutIsTerminal();
+	void reserveStdout();
+	bool open(const std::string& target, StreamFormat format, int frameRate);
+	bool isOpen();
+	bool write(const Image& image);
+	void close();
+}
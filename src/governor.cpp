@@ -0,0 +1,119 @@
+#include "governor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <deque>
+#include <vector>
+
+#define PIXEL_COST_SMOOTHING 0.25f // Weight of the newest measurement in the moving average
+
+namespace Governor {
+	bool enabled = true;
+	bool tiling = true;
+	float navigatingBudget = 16.0f;
+	float idleBudget = 250.0f;
+	float pixelMilliseconds = 0.0f;
+	int bands = 1;
+	int band = 0;
+	int lastUnitCount = 1;
+
+	struct PendingQuery {
+		GLuint query;
+		int pixels;
+		int generation;
+		std::chrono::steady_clock::time_point issued;
+	};
+
+	std::vector<GLuint> freeQueries;
+	std::deque<PendingQuery> pendingQueries; // Oldest first
+	PendingQuery activeQuery;
+	int generation = 0; // Incremented by settingsChanged(), so that the units measured at the previous cost are ignored
+
+	// Folds every measurement the GPU has finished into the moving average, without ever waiting for one
+	void collectQueries() {
+		while (!pendingQueries.empty()) {
+			PendingQuery pending = pendingQueries.front();
+			GLint available = 0;
+			glGetQueryObjectiv(pending.query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) break;
+
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(pending.query, GL_QUERY_RESULT, &nanoseconds);
+			float milliseconds = nanoseconds / 1000000.0f;
+
+			// Some drivers report garbage for the first query they time. A unit can't have taken longer than the time since it was issued,
+			// whereas a measurement that is merely long is real and must be kept, or slow devices would never get a cost to plan with.
+			float elapsedMilliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - pending.issued).count();
+			if (pending.generation == generation && milliseconds <= elapsedMilliseconds) {
+				float perPixel = milliseconds / pending.pixels;
+				pixelMilliseconds = pixelMilliseconds > 0.0f ? pixelMilliseconds + (perPixel - pixelMilliseconds) * PIXEL_COST_SMOOTHING : perPixel;
+			}
+
+			pendingQueries.pop_front();
+			freeQueries.push_back(pending.query);
+		}
+	}
+
+	// Returns how many bands fit in the budget, using the short one while the camera or the settings are being changed
+	int unitCount(bool navigating, int width, int height) {
+		collectQueries();
+
+		float bandMilliseconds = pixelMilliseconds * width * height / bands;
+		if (!enabled || bandMilliseconds <= 0.0f) lastUnitCount = 1;
+		else lastUnitCount = std::max(1, std::min(GOVERNOR_MAX_UNITS, (int)((navigating ? navigatingBudget : idleBudget) / bandMilliseconds)));
+
+		return lastUnitCount;
+	}
+
+	// Called before the first band of every pass: picks how many bands the pass is split into.
+	// Without a cost to go by, the pass could be expensive enough to freeze the GPU, so it is split as finely as allowed.
+	void planBands(int width, int height, bool allowSplit) {
+		float passMilliseconds = pixelMilliseconds * width * height;
+		if (!tiling || !allowSplit) bands = 1;
+		else if (passMilliseconds <= 0.0f) bands = std::max(1, std::min(GOVERNOR_MAX_BANDS, height));
+		else bands = std::max(1, std::min({ GOVERNOR_MAX_BANDS, height, (int)std::ceil(passMilliseconds / navigatingBudget) }));
+	}
+
+	// First row of a band. Bands cover the screen bottom to top, bandStart(bands, height) being the height itself.
+	int bandStart(int bandIndex, int height) {
+		return (int)((long long)height * bandIndex / bands);
+	}
+
+	// Drops the bands already rendered of the current pass, for when what they show is no longer valid
+	void restartPass() {
+		band = 0;
+	}
+
+	// Forgets the measured cost, for settings that change how expensive a pixel is (bounces, shadow rays, passes per frame, backend).
+	// The next passes are planned as if nothing was known, rather than issuing as many bands as the old cost allowed.
+	void settingsChanged() {
+		pixelMilliseconds = 0.0f;
+		generation++;
+	}
+
+	void beginUnit(int pixels) {
+		if (freeQueries.empty()) {
+			GLuint query;
+			glGenQueries(1, &query);
+			freeQueries.push_back(query);
+		}
+
+		activeQuery = { freeQueries.back(), std::max(pixels, 1), generation, std::chrono::steady_clock::now() };
+		freeQueries.pop_back();
+		glBeginQuery(GL_TIME_ELAPSED, activeQuery.query);
+	}
+
+	void endUnit() {
+		glEndQuery(GL_TIME_ELAPSED);
+		pendingQueries.push_back(activeQuery);
+	}
+
+	void cleanup() {
+		for (const PendingQuery& pending : pendingQueries) freeQueries.push_back(pending.query);
+		pendingQueries.clear();
+
+		if (!freeQueries.empty()) glDeleteQueries((GLsizei)freeQueries.size(), freeQueries.data());
+		freeQueries.clear();
+	}
+}
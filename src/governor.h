@@ -0,0 +1,31 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#define GOVERNOR_MAX_UNITS 256 // Upper bound on the bands rendered between two presents
+#define GOVERNOR_MAX_BANDS 64 // Upper bound on the bands one pass is split into
+
+// Chooses how much accumulation work to render before each present, so that a frame takes about as long as the current budget.
+// Work is issued in bands: horizontal slices of the screen, rendered with a scissor rect (or a range of paths by the wavefront backend).
+// A pass is split into as many bands as needed for one band to fit in the navigating budget, so a pass that is too expensive for one
+// frame is spread over several instead of freezing the application.
+// Costs are measured on the GPU with timer queries, whose results are collected a few frames later instead of waiting for them.
+// Until a cost is known (at startup and after every settings change), passes are split into as many bands as allowed and one band is rendered per frame.
+namespace Governor {
+	extern bool enabled; // When disabled, exactly one band is rendered per frame
+	extern bool tiling; // When disabled, passes are never split
+	extern float navigatingBudget, idleBudget; // Target frame times in milliseconds
+	extern float pixelMilliseconds; // Moving average of the measured cost of rendering one pixel, 0 until the first measurement since the last settings change
+	extern int bands; // Bands the current pass is split into
+	extern int band; // Next band of the current pass to render
+	extern int lastUnitCount;
+
+	int unitCount(bool navigating, int width, int height);
+	void planBands(int width, int height, bool allowSplit);
+	int bandStart(int bandIndex, int height);
+	void restartPass();
+	void settingsChanged();
+	void beginUnit(int pixels);
+	void endUnit();
+	void cleanup();
+}
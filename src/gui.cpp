@@ -1,5 +1,11 @@
 #include "gui.h"
 #include "animation.h"
+#include "wavefront.h"
+#include "accumulation.h"
+#include "governor.h"
+#include "invalidation.h"
+#include "profiler.h"
+#include "imagewriter.h"
 
 #include <string>
 #include <iostream>
@@ -9,6 +15,7 @@
 extern float* load_image_data(char const* filename, int* x, int* y, int* channels_in_file, int desired_channels);
 extern void free_image_data(void* imageData);
 extern bool refreshRequired;
+extern bool cameraMoved;
 
 namespace GUI {
 	
@@ -48,42 +55,65 @@ namespace GUI {
 		return std::string(arrayName).append("[").append(std::to_string(index)).append("].").append(keyName);
 	}
 
-	void shaderFloatParameter(const char* name, const char* displayName, float* floatPtr) {
+	bool floatParameter(const char* name, const char* displayName, float* floatPtr) {
+		ImGui::Text(displayName);
+		ImGui::SameLine();
+		return ImGui::InputFloat(std::string("##").append(name).c_str(), floatPtr);
+	}
+
+	bool sliderParameter(const char* name, const char* displayName, float* floatPtr) {
+		ImGui::Text(displayName);
+		ImGui::SameLine();
+		return ImGui::SliderFloat(std::string("##").append(name).c_str(), floatPtr, 0.0f, 1.0f);
+	}
+
+	bool vecParameter(const char* name, const char* displayName, float* floatPtr) {
 		ImGui::Text(displayName);
 		ImGui::SameLine();
-		if (ImGui::InputFloat(std::string("##").append(name).c_str(), floatPtr)) {
+		return ImGui::InputFloat3(std::string("##").append(name).c_str(), floatPtr);
+	}
+
+	bool colorParameter(const char* name, const char* displayName, float* floatPtr) {
+		ImGui::Text(displayName);
+		ImGui::SameLine();
+		return ImGui::ColorPicker3(name, floatPtr);
+	}
+
+	void shaderFloatParameter(const char* name, const char* displayName, float* floatPtr) {
+		if (floatParameter(name, displayName, floatPtr)) {
 			if (Scene::boundShader) glUniform1f(glGetUniformLocation(Scene::boundShader, name), *floatPtr);
 			refreshRequired = true;
 		}
 	}
 	
 	void shaderSliderParameter(const char* name, const char* displayName, float* floatPtr) {
-		ImGui::Text(displayName);
-		ImGui::SameLine();
-		if (ImGui::SliderFloat(std::string("##").append(name).c_str(), floatPtr, 0.0f, 1.0f)) {
+		if (sliderParameter(name, displayName, floatPtr)) {
 			if (Scene::boundShader) glUniform1f(glGetUniformLocation(Scene::boundShader, name), *floatPtr);
 			refreshRequired = true;
 		}
 	}
 
 	void shaderVecParameter(const char* name, const char* displayName, float* floatPtr) {
-		ImGui::Text(displayName);
-		ImGui::SameLine();
-		if (ImGui::InputFloat3(std::string("##").append(name).c_str(), floatPtr)) {
+		if (vecParameter(name, displayName, floatPtr)) {
 			if (Scene::boundShader) glUniform3f(glGetUniformLocation(Scene::boundShader, name), *(floatPtr + 0), *(floatPtr + 1), *(floatPtr + 2));
 			refreshRequired = true;
 		}
 	}
 
 	void shaderColorParameter(const char* name, const char* displayName, float* floatPtr) {
-		ImGui::Text(displayName);
-		ImGui::SameLine();
-		if (ImGui::ColorPicker3(name, floatPtr)) {
+		if (colorParameter(name, displayName, floatPtr)) {
 			if (Scene::boundShader) glUniform3f(glGetUniformLocation(Scene::boundShader, name), *(floatPtr + 0), *(floatPtr + 1), *(floatPtr + 2));
 			refreshRequired = true;
 		}
 	}
 
+	// Objects live in a storage buffer rather than in uniforms, so edits re-upload the whole object.
+	// Material edits only reset the pixels around the object, anything else resets everything (see Invalidation).
+	void objectChanged(int objectIndex, const Scene::Object& previousObject) {
+		if (Scene::boundShader) Scene::sendObjectData(objectIndex);
+		Invalidation::invalidateObject(previousObject, Scene::objects[objectIndex]);
+	}
+
 	void objectSettingsUI() {
 		ImGui::Begin("Selected object");
 		
@@ -91,10 +121,11 @@ namespace GUI {
 		if (Scene::selectedObjectIndex != -1) {
 			int i = Scene::selectedObjectIndex;
 			std::string indexStr = std::to_string(i);
+			Scene::Object previousObject = Scene::objects[i];
 
 			ImGui::Text(std::string("Object #").append(indexStr).c_str());
 			
-			shaderVecParameter(arrayElementName("u_objects", i, "position").c_str(), "Position", Scene::objects[i].position);
+			if (vecParameter(arrayElementName("u_objects", i, "position").c_str(), "Position", Scene::objects[i].position)) objectChanged(i, previousObject);
 			
 			ImGui::Text("Is box");
 			ImGui::SameLine();
@@ -103,8 +134,6 @@ namespace GUI {
 			std::string scaleVariableName = arrayElementName("u_objects", i, "scale");
 			if (ImGui::Checkbox(std::string("##").append(typeVariableName).c_str(), &isBox)) {
 				Scene::objects[i].type = isBox ? 2 : 1;
-				if (Scene::boundShader) glUniform1ui(glGetUniformLocation(Scene::boundShader, typeVariableName.c_str()), Scene::objects[i].type);
-				refreshRequired = true;
 
 				if (isBox) {
 					Scene::objects[i].scale[0] *= 2.0f;
@@ -118,7 +147,7 @@ namespace GUI {
 					Scene::objects[i].scale[2] = minDimension / 2.0f;
 				}
 
-				if (Scene::boundShader) glUniform3f(glGetUniformLocation(Scene::boundShader, scaleVariableName.c_str()), Scene::objects[i].scale[0], Scene::objects[i].scale[1], Scene::objects[i].scale[2]);
+				objectChanged(i, previousObject);
 			}
 			
 			if (Scene::objects[i].type == 1) {
@@ -127,22 +156,21 @@ namespace GUI {
 				if (ImGui::InputFloat(std::string("##").append(scaleVariableName).c_str(), &Scene::objects[i].scale[0])) {
 					Scene::objects[i].scale[1] = Scene::objects[i].scale[0];
 					Scene::objects[i].scale[2] = Scene::objects[i].scale[0];
-					if (Scene::boundShader) glUniform3f(glGetUniformLocation(Scene::boundShader, scaleVariableName.c_str()), Scene::objects[i].scale[0], Scene::objects[i].scale[1], Scene::objects[i].scale[2]);
-					refreshRequired = true;
+					objectChanged(i, previousObject);
 				}
 			}
 			else if (Scene::objects[i].type == 2) {
-				shaderVecParameter(scaleVariableName.c_str(), "Scale", Scene::objects[i].scale);
+				if (vecParameter(scaleVariableName.c_str(), "Scale", Scene::objects[i].scale)) objectChanged(i, previousObject);
 			}
 
-			shaderColorParameter(arrayElementName("u_objects", i, "material.albedo").c_str(), "Albedo", Scene::objects[i].material.albedo);
-			shaderColorParameter(arrayElementName("u_objects", i, "material.specular").c_str(), "Specular", Scene::objects[i].material.specular);
-			shaderColorParameter(arrayElementName("u_objects", i, "material.emission").c_str(), "Emission", Scene::objects[i].material.emission);
-			shaderFloatParameter(arrayElementName("u_objects", i, "material.emissionStrength").c_str(), "Emission Strength", &Scene::objects[i].material.emissionStrength);
+			if (colorParameter(arrayElementName("u_objects", i, "material.albedo").c_str(), "Albedo", Scene::objects[i].material.albedo)) objectChanged(i, previousObject);
+			if (colorParameter(arrayElementName("u_objects", i, "material.specular").c_str(), "Specular", Scene::objects[i].material.specular)) objectChanged(i, previousObject);
+			if (colorParameter(arrayElementName("u_objects", i, "material.emission").c_str(), "Emission", Scene::objects[i].material.emission)) objectChanged(i, previousObject);
+			if (floatParameter(arrayElementName("u_objects", i, "material.emissionStrength").c_str(), "Emission Strength", &Scene::objects[i].material.emissionStrength)) objectChanged(i, previousObject);
 
-			shaderSliderParameter(arrayElementName("u_objects", i, "material.roughness").c_str(), "Roughness", &Scene::objects[i].material.roughness);
-			shaderSliderParameter(arrayElementName("u_objects", i, "material.specularHighlight").c_str(), "Highlight", &Scene::objects[i].material.specularHighlight);
-			shaderSliderParameter(arrayElementName("u_objects", i, "material.specularExponent").c_str(), "Exponent", &Scene::objects[i].material.specularExponent);
+			if (sliderParameter(arrayElementName("u_objects", i, "material.roughness").c_str(), "Roughness", &Scene::objects[i].material.roughness)) objectChanged(i, previousObject);
+			if (sliderParameter(arrayElementName("u_objects", i, "material.specularHighlight").c_str(), "Highlight", &Scene::objects[i].material.specularHighlight)) objectChanged(i, previousObject);
+			if (sliderParameter(arrayElementName("u_objects", i, "material.specularExponent").c_str(), "Exponent", &Scene::objects[i].material.specularExponent)) objectChanged(i, previousObject);
 
 			ImGui::NewLine();
 		}
@@ -171,48 +199,52 @@ namespace GUI {
 		ImGui::End();
 	}
 
+	// Lights live in a storage buffer and are picked through a tree built from their positions and power, so any edit uploads them again.
+	// Only the pixels within the light's reach before and after the edit are reset (see Invalidation).
+	void lightChanged(int lightIndex, const Scene::PointLight& previousLight) {
+		if (Scene::boundShader) Scene::sendLights();
+		Invalidation::invalidateLight(previousLight);
+		Invalidation::invalidateLight(Scene::lights[lightIndex]);
+	}
+
 	void lightSettingsUI() {
 		ImGui::Begin("Light settings");
 
 		ImGui::PushItemWidth(-1);
 		for (int i = 0; i < Scene::lights.size(); i++) {
 			std::string indexStr = std::to_string(i);
+			Scene::PointLight previousLight = Scene::lights[i];
 
 			ImGui::Text(std::string("Light #").append(indexStr).c_str());
 			ImGui::Text("Position");
 			ImGui::SameLine();
 			if (ImGui::InputFloat3(std::string("##light_pos_").append(indexStr).c_str(), Scene::lights[i].position)) {
-				if (Scene::boundShader) glUniform3f(glGetUniformLocation(Scene::boundShader, std::string("u_lights[").append(std::to_string(i)).append("].position").c_str()), Scene::lights[i].position[0], Scene::lights[i].position[1], Scene::lights[i].position[2]);
-				refreshRequired = true;
+				lightChanged(i, previousLight);
 			}
 
 			ImGui::Text("Radius");
 			ImGui::SameLine();
 			if (ImGui::InputFloat(std::string("##light_radius_").append(indexStr).c_str(), &Scene::lights[i].radius)) {
-				if (Scene::boundShader) glUniform1f(glGetUniformLocation(Scene::boundShader, std::string("u_lights[").append(std::to_string(i)).append("].radius").c_str()), Scene::lights[i].radius);
-				refreshRequired = true;
+				lightChanged(i, previousLight);
 			}
 
 			ImGui::Text(std::string("Light #").append(indexStr).c_str());
 			ImGui::Text("Color");
 			ImGui::SameLine();
 			if (ImGui::ColorPicker3(std::string("##light_color_").append(indexStr).c_str(), Scene::lights[i].color)) {
-				if (Scene::boundShader) glUniform3f(glGetUniformLocation(Scene::boundShader, std::string("u_lights[").append(std::to_string(i)).append("].color").c_str()), Scene::lights[i].color[0], Scene::lights[i].color[1], Scene::lights[i].color[2]);
-				refreshRequired = true;
+				lightChanged(i, previousLight);
 			}
 
 			ImGui::Text("Power");
 			ImGui::SameLine();
 			if (ImGui::InputFloat(std::string("##light_power_").append(indexStr).c_str(), &Scene::lights[i].power)) {
-				if (Scene::boundShader) glUniform1f(glGetUniformLocation(Scene::boundShader, std::string("u_lights[").append(std::to_string(i)).append("].power").c_str()), Scene::lights[i].power);
-				refreshRequired = true;
+				lightChanged(i, previousLight);
 			}
 
 			ImGui::Text("Reach");
 			ImGui::SameLine();
 			if (ImGui::InputFloat(std::string("##light_reach_").append(indexStr).c_str(), &Scene::lights[i].reach)) {
-				if (Scene::boundShader) glUniform1f(glGetUniformLocation(Scene::boundShader, std::string("u_lights[").append(std::to_string(i)).append("].reach").c_str()), Scene::lights[i].reach);
-				refreshRequired = true;
+				lightChanged(i, previousLight);
 			}
 
 			if (i < 2) ImGui::NewLine();
@@ -227,10 +259,26 @@ namespace GUI {
 		ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
 
 		ImGui::PushItemWidth(-1);
-		ImGui::Text("Shadow resolution");
+		ImGui::Text("Wavefront backend");
 		ImGui::SameLine();
-		if (ImGui::InputInt("##shadowResolution", &Scene::shadowResolution)) {
-			if (Scene::boundShader) glUniform1i(glGetUniformLocation(Scene::boundShader, "u_shadowResolution"), Scene::shadowResolution);
+		if (ImGui::Checkbox("##wavefront", &Wavefront::enabled)) {
+			Governor::settingsChanged();
+			refreshRequired = true;
+		}
+
+		ImGui::Text("Half-float accumulation");
+		ImGui::SameLine();
+		if (ImGui::Checkbox("##packedAccumulation", &Accumulation::packed)) {
+			Accumulation::allocate(Accumulation::width, Accumulation::height);
+			if (Scene::boundShader) glUniform1i(glGetUniformLocation(Scene::boundShader, "u_packedAccumulation"), Accumulation::packed);
+			refreshRequired = true;
+		}
+
+		ImGui::Text("Shadow rays");
+		ImGui::SameLine();
+		if (ImGui::InputInt("##shadowRays", &Scene::shadowRays)) {
+			if (Scene::boundShader) glUniform1i(glGetUniformLocation(Scene::boundShader, "u_shadowRays"), Scene::shadowRays);
+			Governor::settingsChanged();
 			refreshRequired = true;
 		}
 
@@ -238,6 +286,15 @@ namespace GUI {
 		ImGui::SameLine();
 		if (ImGui::InputInt("##lightBounces", &Scene::lightBounces)) {
 			if (Scene::boundShader) glUniform1i(glGetUniformLocation(Scene::boundShader, "u_lightBounces"), Scene::lightBounces);
+			Governor::settingsChanged();
+			refreshRequired = true;
+		}
+
+		ImGui::Text("Roulette min depth");
+		ImGui::SameLine();
+		if (ImGui::InputInt("##rouletteDepth", &Scene::rouletteDepth)) {
+			if (Scene::boundShader) glUniform1i(glGetUniformLocation(Scene::boundShader, "u_rouletteDepth"), Scene::rouletteDepth);
+			Governor::settingsChanged();
 			refreshRequired = true;
 		}
 
@@ -245,8 +302,73 @@ namespace GUI {
 		ImGui::SameLine();
 		if (ImGui::InputInt("##framePasses", &Scene::framePasses)) {
 			if (Scene::boundShader) glUniform1i(glGetUniformLocation(Scene::boundShader, "u_framePasses"), Scene::framePasses);
+			Governor::settingsChanged();
+			refreshRequired = true;
+		}
+
+		ImGui::Text("Frame governor");
+		ImGui::SameLine();
+		ImGui::Checkbox("##governor", &Governor::enabled);
+		if (Governor::enabled) {
+			ImGui::Text("Navigating budget (ms)");
+			ImGui::SameLine();
+			if (ImGui::InputFloat("##navigatingBudget", &Governor::navigatingBudget)) Governor::navigatingBudget = std::max(Governor::navigatingBudget, 1.0f);
+
+			ImGui::Text("Idle budget (ms)");
+			ImGui::SameLine();
+			if (ImGui::InputFloat("##idleBudget", &Governor::idleBudget)) Governor::idleBudget = std::max(Governor::idleBudget, 1.0f);
+		}
+		ImGui::Text("Split passes into bands");
+		ImGui::SameLine();
+		ImGui::Checkbox("##tiling", &Governor::tiling);
+		ImGui::Text("%d bands per frame, %d bands per pass", Governor::lastUnitCount, Governor::bands);
+
+		ImGui::Text("Preview while moving");
+		ImGui::SameLine();
+		ImGui::Checkbox("##previewEnabled", &Scene::previewEnabled);
+		if (Scene::previewEnabled) {
+			ImGui::Text("Preview scale");
+			ImGui::SameLine();
+			ImGui::SliderFloat("##previewScale", &Scene::previewScale, 0.1f, 1.0f);
+
+			ImGui::Text("Preview bounces");
+			ImGui::SameLine();
+			if (ImGui::InputInt("##previewBounces", &Scene::previewBounces)) Scene::previewBounces = std::max(Scene::previewBounces, 1);
+
+			ImGui::Text("Preview delay (ms)");
+			ImGui::SameLine();
+			if (ImGui::InputFloat("##previewDelay", &Scene::previewDelay)) Scene::previewDelay = std::max(Scene::previewDelay, 0.0f);
+		}
+
+		ImGui::Text("Reproject on camera moves");
+		ImGui::SameLine();
+		if (ImGui::Checkbox("##reprojectionEnabled", &Scene::reprojectionEnabled)) refreshRequired = true;
+		if (Scene::reprojectionEnabled) {
+			ImGui::Text("Max history (passes)");
+			ImGui::SameLine();
+			if (ImGui::InputInt("##reprojectionHistory", &Scene::reprojectionHistory)) {
+				Scene::reprojectionHistory = std::max(Scene::reprojectionHistory, 1);
+				if (Scene::boundShader) glUniform1i(glGetUniformLocation(Scene::boundShader, "u_maxHistory"), Scene::reprojectionHistory);
+			}
+		}
+
+		ImGui::Text("Regional resets on edits");
+		ImGui::SameLine();
+		ImGui::Checkbox("##regionalInvalidation", &Invalidation::regional);
+		if (Invalidation::regional) {
+			ImGui::Text("Indirect margin");
+			ImGui::SameLine();
+			if (ImGui::InputFloat("##invalidationMargin", &Invalidation::margin)) Invalidation::margin = std::max(Invalidation::margin, 0.0f);
+		}
+
+		ImGui::Text("Adaptive threshold");
+		ImGui::SameLine();
+		if (ImGui::InputFloat("##adaptiveThreshold", &Scene::adaptiveThreshold, 0.001f, 0.01f, "%.4f")) {
+			if (Scene::adaptiveThreshold < 0.0f) Scene::adaptiveThreshold = 0.0f;
+			if (Scene::boundShader) glUniform1f(glGetUniformLocation(Scene::boundShader, "u_adaptiveThreshold"), Scene::adaptiveThreshold);
 			refreshRequired = true;
 		}
+		if (Scene::adaptiveThreshold > 0.0f) ImGui::Text("Converged %.1f%%", Scene::convergedFraction * 100.0f);
 
 		ImGui::Text("Blur");
 		ImGui::SameLine();
@@ -257,18 +379,18 @@ namespace GUI {
 
 		ImGui::Text("Bloom Radius");
 		ImGui::SameLine();
-		if (ImGui::InputFloat("##bloomRadius", &Scene::bloomRadius)) {
-			if (Scene::boundShader) glUniform1f(glGetUniformLocation(Scene::boundShader, "u_bloomRadius"), Scene::bloomRadius);
-			refreshRequired = true;
-		}
+		if (ImGui::InputFloat("##bloomRadius", &Scene::bloomRadius)) Scene::bloomRadius = std::max(Scene::bloomRadius, 0.0f);
 
 		ImGui::Text("Bloom Intensity");
 		ImGui::SameLine();
 		if (ImGui::InputFloat("##bloomIntensity", &Scene::bloomIntensity)) {
-			if (Scene::boundShader) glUniform1f(glGetUniformLocation(Scene::boundShader, "u_bloomIntensity"), Scene::bloomIntensity);
-			refreshRequired = true;
+			if (Scene::boundShader) glUniform1f(glGetUniformLocation(Scene::boundShader, "u_bloomIntensity"), Scene::bloomIntensity); // Only read by the display pass
 		}
 
+		ImGui::Text("Bloom Threshold");
+		ImGui::SameLine();
+		ImGui::InputFloat("##bloomThreshold", &Scene::bloomThreshold);
+
 		if (ImGui::Button("Quit")) {
 			shouldQuit = true;
 		}
@@ -310,15 +432,9 @@ namespace GUI {
 		
 		if (ImGui::Button("Load")) {
 			int sbWidth, sbHeight, sbChannels;
-			float* skyboxData = load_image_data(std::string("skyboxes\\").append(skyboxFilename).c_str(), &sbWidth, &sbHeight, &sbChannels, 0);
+			float* skyboxData = load_image_data(std::string("skyboxes/").append(skyboxFilename).c_str(), &sbWidth, &sbHeight, &sbChannels, 3);
 			if (skyboxData) {
-				glActiveTexture(GL_TEXTURE1);
-				glBindTexture(GL_TEXTURE_2D, Scene::skyboxTexture);
-				glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, sbWidth, sbHeight, 0, GL_RGB, GL_FLOAT, skyboxData);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-				glActiveTexture(GL_TEXTURE0);
-
+				Scene::loadSkybox(skyboxData, sbWidth, sbHeight);
 				free_image_data(skyboxData);
 
 				skyboxFilename[0] = 0;
@@ -326,7 +442,7 @@ namespace GUI {
 				refreshRequired = true;
 			}
 			else {
-				std::cout << "Failed to load skyboxes\\" << skyboxFilename << std::endl;
+				std::cout << "Failed to load skyboxes/" << skyboxFilename << std::endl;
 			}
 		}
 
@@ -348,6 +464,11 @@ namespace GUI {
 		ImGui::InputInt("animationFramePasses", &Animation::framePasses);
 		ImGui::InputFloat("animationSpeed", &Animation::cameraSpeed);
 		ImGui::InputInt("animationFrameRate", &Animation::frameRate);
+		ImGui::Combo("animationFormat", (int*)&Animation::outputFormat, ImageWriter::formatNames, FORMAT_COUNT);
+		if (Animation::outputFormat == FORMAT_STREAM) {
+			ImGui::Combo("animationStreamFormat", (int*)&Animation::streamFormat, FrameStream::formatNames, STREAM_FORMAT_COUNT);
+			ImGui::InputText("animationStreamTarget", Animation::streamTarget, sizeof(Animation::streamTarget));
+		}
 
 		if (ImGui::Button("Render")) {
 			Animation::currentFrame = -1; // Set to -1 so the main loop can finish its current iteration before the animation rendering process starts
@@ -357,17 +478,44 @@ namespace GUI {
 		}
 
 		ImGui::Text("Rendered %d/%d frames.", Animation::currentFrame, Animation::totalFrameCount);
+		int pendingWrites = ImageWriter::pendingCount();
+		if (pendingWrites > 0) ImGui::Text("%d frames waiting to be written.", pendingWrites);
 		
 		ImGui::End();
 	}
 
+	void profilerUI() {
+		ImGui::Begin("Profiler");
+		ImGui::Text("CPU frame: %.2f ms", Profiler::cpuMilliseconds);
+		ImGui::Text("GPU frame: %.2f ms", Profiler::gpuMilliseconds);
+		for (int stage = 0; stage < Profiler::STAGE_COUNT; stage++) {
+			ImGui::Text("  %s: %.2f ms", Profiler::stageNames[stage], Profiler::stageMilliseconds[stage]);
+		}
+		ImGui::Text("Rays: %.1f M/s (estimated from %d bounces, %d shadow rays)", Profiler::raysPerSecond / 1000000.0, Scene::lightBounces, Scene::shadowRays);
+
+		ImGui::PushItemWidth(-1);
+		ImGui::Text("CSV log");
+		ImGui::SameLine();
+		bool logging = Profiler::logging;
+		if (ImGui::Checkbox("##profilerLogging", &logging)) {
+			if (logging) Profiler::startLog();
+			else Profiler::stopLog();
+		}
+		if (!Profiler::logging) {
+			ImGui::SameLine();
+			ImGui::InputText("##profilerLogPath", Profiler::logPath, sizeof(Profiler::logPath));
+		}
+		ImGui::PopItemWidth();
+		ImGui::End();
+	}
+
 	void cameraSettingsUI() {
 		ImGui::Begin("Camera");
 		ImGui::PushItemWidth(-1);
 		ImGui::Text("Position");
 		ImGui::SameLine();
 		if (ImGui::InputFloat3("##cameraPosition", &Scene::cameraPosition.x)) {
-			refreshRequired = true;
+			cameraMoved = true;
 		}
 
 		ImGui::Text("Orientation (Yaw-Pitch)");
@@ -377,7 +525,7 @@ namespace GUI {
 			Scene::cameraYaw = cameraOrientation[0];
 			Scene::cameraPitch = cameraOrientation[1];
 
-			refreshRequired = true;
+			cameraMoved = true;
 		}
 		ImGui::PopItemWidth();
 		ImGui::End();
@@ -393,6 +541,7 @@ namespace GUI {
 		appSettingsUI();
 		skyboxSettingsUI();
 		cameraSettingsUI();
+		profilerUI();
 		if (animationRenderWindowVisible) animationRenderingUI();
 
 		ImGui::Render();
@@ -0,0 +1,87 @@
+#include "headless.h"
+
+#include <iostream>
+
+#ifdef HEADLESS_EGL
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#else
+#include <GLFW/glfw3.h>
+#endif
+
+namespace Headless {
+#ifdef HEADLESS_EGL
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+
+	bool createContext() {
+		// Drivers without the surfaceless platform may still create a context without a surface on their default display
+		PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+		if (getPlatformDisplay) display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+		if (display == EGL_NO_DISPLAY) display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, NULL, NULL)) {
+			std::cout << "Failed to initialize EGL!" << std::endl;
+			return false;
+		}
+
+		const EGLint contextAttributes[] = {
+			EGL_CONTEXT_MAJOR_VERSION, 4,
+			EGL_CONTEXT_MINOR_VERSION, 3,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_NONE
+		};
+		eglBindAPI(EGL_OPENGL_API);
+		context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, contextAttributes);
+
+		if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+			std::cout << "Failed to create an OpenGL 4.3 context without a surface!" << std::endl;
+			destroyContext();
+			return false;
+		}
+
+		return true;
+	}
+
+	void destroyContext() {
+		if (display == EGL_NO_DISPLAY) return;
+
+		eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		if (context != EGL_NO_CONTEXT) eglDestroyContext(display, context);
+		eglTerminate(display);
+		context = EGL_NO_CONTEXT;
+		display = EGL_NO_DISPLAY;
+	}
+#else
+	// Fallback of the builds without HEADLESS_EGL (the Visual Studio one): a hidden window, which still needs a display
+	GLFWwindow* window = nullptr;
+
+	bool createContext() {
+		if (!glfwInit()) {
+			std::cout << "Failed to initialize GLFW!" << std::endl;
+			return false;
+		}
+
+		// Never shown or swapped, so its size doesn't matter
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+		window = glfwCreateWindow(1, 1, "OpenGL Raytracing", NULL, NULL);
+
+		if (!window) {
+			std::cout << "Failed to create a hidden window! Without HEADLESS_EGL, --headless still needs a display (see the CMake build)." << std::endl;
+			glfwTerminate();
+			return false;
+		}
+
+		glfwMakeContextCurrent(window);
+		return true;
+	}
+
+	void destroyContext() {
+		if (!window) return;
+
+		glfwDestroyWindow(window);
+		glfwTerminate();
+		window = nullptr;
+	}
+#endif
+}
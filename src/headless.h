@@ -0,0 +1,11 @@
+#pragma once
+
+// OpenGL context for rendering without a display, used by the --headless mode of main.cpp. Nothing is ever presented:
+// passes render into the accumulation targets and the result is read back from there.
+// Built with HEADLESS_EGL, the context comes from EGL's surfaceless platform, which needs neither a window nor a display server
+// (Mesa's llvmpipe included). GLEW must then be built with GLEW_EGL. The CMake build defines it by default.
+// Otherwise the context belongs to a hidden GLFW window: nothing shows up on screen, but a display is still required.
+namespace Headless {
+	bool createContext();
+	void destroyContext();
+}
@@ -0,0 +1,211 @@
+#include "imagewriter.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <glm/gtc/packing.hpp>
+
+#include "stb_image_write.h"
+#include "framestream.h"
+
+namespace ImageWriter {
+	std::vector<std::thread> workers;
+	std::deque<Image> queue;
+	int busyWorkers = 0;
+	bool stopping = false;
+	std::mutex mutex;
+	std::condition_variable workAvailable, spaceAvailable, idle;
+
+	const char* formatNames[FORMAT_COUNT] = { "PNG (8-bit, clamped)", "Radiance HDR", "PFM (32-bit float)", "OpenEXR (16-bit half float)", "Stream to stdout or a pipe" };
+	const char* formatExtensions[FORMAT_COUNT] = { ".png", ".hdr", ".pfm", ".exr", "" };
+
+	// Picks the file format matching the file's extension, if any
+	bool formatFromPath(const std::string& filepath, ImageFormat& format) {
+		for (int i = 0; i < FORMAT_COUNT; i++) {
+			size_t length = strlen(formatExtensions[i]);
+			if (length > 0 && filepath.size() >= length && filepath.compare(filepath.size() - length, length, formatExtensions[i]) == 0) {
+				format = (ImageFormat)i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	// Rows are flipped here rather than with stbi_flip_vertically_on_write, as that flag is shared by every thread
+	std::vector<float> topToBottom(const Image& image) {
+		size_t stride = (size_t)image.width * 3;
+		std::vector<float> pixels(image.pixels.size());
+		for (int y = 0; y < image.height; y++) {
+			std::copy_n(image.pixels.data() + (image.height - 1 - y) * stride, stride, pixels.data() + y * stride);
+		}
+		return pixels;
+	}
+
+	bool writePng(const Image& image) {
+		std::vector<float> pixels = topToBottom(image);
+		std::vector<unsigned char> bytes(pixels.size());
+		for (size_t i = 0; i < bytes.size(); i++) bytes[i] = (unsigned char)(std::min(std::max(pixels[i], 0.0f), 1.0f) * 255);
+
+		return stbi_write_png(image.filepath.c_str(), image.width, image.height, 3, bytes.data(), image.width * 3) != 0;
+	}
+
+	bool writeHdr(const Image& image) {
+		std::vector<float> pixels = topToBottom(image);
+		return stbi_write_hdr(image.filepath.c_str(), image.width, image.height, 3, pixels.data()) != 0;
+	}
+
+	// PFM stores its rows from bottom to top like the readback. A negative scale means little-endian.
+	bool writePfm(const Image& image) {
+		std::ofstream file(image.filepath, std::ios::binary);
+		file << "PF\n" << image.width << " " << image.height << "\n-1.0\n";
+		file.write((const char*)image.pixels.data(), image.pixels.size() * sizeof(float));
+		return (bool)file;
+	}
+
+	template <typename T>
+	void writeBinary(std::ofstream& file, T value) {
+		file.write((const char*)&value, sizeof(T));
+	}
+
+	void writeAttribute(std::ofstream& file, const char* name, const char* type, int size) {
+		file.write(name, strlen(name) + 1);
+		file.write(type, strlen(type) + 1);
+		writeBinary<int>(file, size);
+	}
+
+	// Single-part scanline OpenEXR without compression, one scanline per block. Channels are stored in alphabetical order, rows from top to bottom.
+	bool writeExr(const Image& image) {
+		std::ofstream file(image.filepath, std::ios::binary);
+		writeBinary<int>(file, 20000630); // Magic number
+		writeBinary<int>(file, 2); // Version, no flags
+
+		const char* channels[] = { "B", "G", "R" };
+		writeAttribute(file, "channels", "chlist", 3 * 18 + 1);
+		for (const char* channel : channels) {
+			file.write(channel, 2);
+			writeBinary<int>(file, 1); // HALF
+			writeBinary<int>(file, 0); // pLinear and reserved
+			writeBinary<int>(file, 1); // xSampling
+			writeBinary<int>(file, 1); // ySampling
+		}
+		writeBinary<char>(file, 0);
+
+		writeAttribute(file, "compression", "compression", 1);
+		writeBinary<char>(file, 0); // NO_COMPRESSION
+		for (const char* window : { "dataWindow", "displayWindow" }) {
+			writeAttribute(file, window, "box2i", 16);
+			writeBinary<int>(file, 0);
+			writeBinary<int>(file, 0);
+			writeBinary<int>(file, image.width - 1);
+			writeBinary<int>(file, image.height - 1);
+		}
+		writeAttribute(file, "lineOrder", "lineOrder", 1);
+		writeBinary<char>(file, 0); // INCREASING_Y
+		writeAttribute(file, "pixelAspectRatio", "float", 4);
+		writeBinary<float>(file, 1.0f);
+		writeAttribute(file, "screenWindowCenter", "v2f", 8);
+		writeBinary<float>(file, 0.0f);
+		writeBinary<float>(file, 0.0f);
+		writeAttribute(file, "screenWindowWidth", "float", 4);
+		writeBinary<float>(file, 1.0f);
+		writeBinary<char>(file, 0); // End of the header
+
+		int blockSize = image.width * 3 * sizeof(uint16_t);
+		uint64_t offset = (uint64_t)file.tellp() + (uint64_t)image.height * sizeof(uint64_t);
+		for (int y = 0; y < image.height; y++) {
+			writeBinary<uint64_t>(file, offset);
+			offset += 2 * sizeof(int) + blockSize;
+		}
+
+		std::vector<uint16_t> block(image.width * 3);
+		for (int y = 0; y < image.height; y++) {
+			const float* row = image.pixels.data() + (size_t)(image.height - 1 - y) * image.width * 3;
+			for (int c = 0; c < 3; c++) {
+				for (int x = 0; x < image.width; x++) block[c * image.width + x] = glm::packHalf1x16(row[x * 3 + 2 - c]);
+			}
+
+			writeBinary<int>(file, y);
+			writeBinary<int>(file, blockSize);
+			file.write((const char*)block.data(), blockSize);
+		}
+		return (bool)file;
+	}
+
+	bool write(const Image& image) {
+		bool written = false;
+		switch (image.format) {
+			case FORMAT_PNG: written = writePng(image); break;
+			case FORMAT_HDR: written = writeHdr(image); break;
+			case FORMAT_PFM: written = writePfm(image); break;
+			case FORMAT_EXR: written = writeExr(image); break;
+			case FORMAT_STREAM: return FrameStream::write(image);
+			default: break;
+		}
+
+		if (!written) std::cout << "ERROR: Could not write " << image.filepath << std::endl;
+		return written;
+	}
+
+	void work() {
+		std::unique_lock<std::mutex> lock(mutex);
+		while (true) {
+			workAvailable.wait(lock, [] { return stopping || !queue.empty(); });
+			if (queue.empty()) return; // Only stops once everything submitted has been written
+
+			Image image = std::move(queue.front());
+			queue.pop_front();
+			busyWorkers++;
+			spaceAvailable.notify_one();
+
+			lock.unlock();
+			write(image);
+			lock.lock();
+
+			busyWorkers--;
+			if (queue.empty() && busyWorkers == 0) idle.notify_all();
+		}
+	}
+
+	// Queues the image for a worker, waiting for room in the queue if the workers are behind
+	void submit(Image&& image) {
+		std::unique_lock<std::mutex> lock(mutex);
+		if (workers.empty()) {
+			int count = std::max(1, std::min((int)std::thread::hardware_concurrency() - 1, IMAGE_WRITER_MAX_THREADS));
+			stopping = false;
+			for (int i = 0; i < count; i++) workers.emplace_back(work);
+		}
+
+		spaceAvailable.wait(lock, [] { return queue.size() < IMAGE_WRITER_QUEUE_SIZE; });
+		queue.push_back(std::move(image));
+		workAvailable.notify_one();
+	}
+
+	// Frames submitted but not written yet
+	int pendingCount() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return (int)queue.size() + busyWorkers;
+	}
+
+	// Waits until every submitted frame has been written
+	void finish() {
+		std::unique_lock<std::mutex> lock(mutex);
+		idle.wait(lock, [] { return queue.empty() && busyWorkers == 0; });
+	}
+
+	// Writes what is left and stops the workers
+	void shutdown() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		workAvailable.notify_all();
+		for (std::thread& worker : workers) worker.join();
+		workers.clear();
+	}
+}
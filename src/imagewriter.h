@@ -0,0 +1,40 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#define IMAGE_WRITER_QUEUE_SIZE 4 // Frames waiting for a worker. Submitting more blocks until one is taken, which bounds memory use.
+#define IMAGE_WRITER_MAX_THREADS 8
+
+enum ImageFormat {
+	FORMAT_PNG, // 8 bits per channel, clamped to [0, 1]
+	FORMAT_HDR, // Radiance RGBE
+	FORMAT_PFM, // Portable float map, 32-bit floats
+	FORMAT_EXR, // Uncompressed OpenEXR, 16-bit half floats
+	FORMAT_STREAM, // Sent to FrameStream rather than to a file of its own, see framestream.h
+	FORMAT_COUNT
+};
+
+// Frame read back from the accumulation targets: the mean of the accumulated passes, as RGB floats with rows from bottom to top
+struct Image {
+	int width = 0, height = 0;
+	std::vector<float> pixels;
+	std::string filepath;
+	ImageFormat format = FORMAT_PNG;
+	int frame = 0; // Position in the render's sequence of frames, which streams are written in
+};
+
+// Turns frames read back by Capture into files. Every format but PNG keeps the unclamped values of the accumulation, for exposure to be chosen later.
+// Encoding (PNG compression mostly) runs on a pool of worker threads,
+// started with the first submitted frame (one per hardware thread but the render thread's), so that the render thread only has to hand the frame over.
+namespace ImageWriter {
+	extern const char* formatNames[FORMAT_COUNT];
+	extern const char* formatExtensions[FORMAT_COUNT];
+
+	bool formatFromPath(const std::string& filepath, ImageFormat& format);
+	bool write(const Image& image);
+	void submit(Image&& image);
+	int pendingCount();
+	void finish();
+	void shutdown();
+}
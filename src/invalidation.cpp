@@ -0,0 +1,102 @@
+#include "invalidation.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "accumulation.h"
+
+extern bool refreshRequired;
+
+namespace Invalidation {
+	bool regional = true;
+	float margin = 1.0f;
+
+	bool hasRegion = false;
+	glm::vec2 regionMin, regionMax; // In screen UVs, like fragUV
+
+	void invalidateBounds(glm::vec3 boundsMin, glm::vec3 boundsMax) {
+		if (!regional) {
+			refreshRequired = true;
+			return;
+		}
+
+		boundsMin -= glm::vec3(margin);
+		boundsMax += glm::vec3(margin);
+
+		// Same camera as the main loop and generateCameraRay
+		glm::mat4 rotationMatrix = glm::rotate(glm::rotate(glm::mat4(1), Scene::cameraPitch, glm::vec3(1, 0, 0)), Scene::cameraYaw, glm::vec3(0, 1, 0));
+		float aspectRatio = (float)Accumulation::width / Accumulation::height;
+
+		glm::vec2 cornersMin(1.0f), cornersMax(0.0f);
+		for (int corner = 0; corner < 8; corner++) {
+			glm::vec3 position((corner & 1) ? boundsMax.x : boundsMin.x, (corner & 2) ? boundsMax.y : boundsMin.y, (corner & 4) ? boundsMax.z : boundsMin.z);
+			glm::vec3 viewDirection = glm::vec3(rotationMatrix * glm::vec4(position - Scene::cameraPosition, 0.0f));
+
+			// The bounds reach behind the camera, so they may cover any part of the screen
+			if (viewDirection.z > -0.0001f) {
+				refreshRequired = true;
+				return;
+			}
+
+			glm::vec2 uv = (glm::vec2(viewDirection) / -viewDirection.z / glm::vec2(aspectRatio, 1.0f) + glm::vec2(1.0f)) / 2.0f;
+			cornersMin = glm::min(cornersMin, uv);
+			cornersMax = glm::max(cornersMax, uv);
+		}
+
+		cornersMin = glm::max(cornersMin, glm::vec2(0.0f));
+		cornersMax = glm::min(cornersMax, glm::vec2(1.0f));
+		if (cornersMin.x >= cornersMax.x || cornersMin.y >= cornersMax.y) return; // Off screen
+
+		regionMin = hasRegion ? glm::min(regionMin, cornersMin) : cornersMin;
+		regionMax = hasRegion ? glm::max(regionMax, cornersMax) : cornersMax;
+		hasRegion = true;
+	}
+
+	// Only material edits of objects that don't emit light are regional. Moving, resizing or reshaping an object also moves the shadows it casts
+	// from every light and from the skybox, and its reflections in mirror surfaces, far outside its bounds and their margin.
+	// Emissive objects light the whole scene, so changing one, or turning one off, resets everything as well.
+	void invalidateObject(const Scene::Object& previousObject, const Scene::Object& object) {
+		bool geometryChanged = previousObject.type != object.type
+			|| !std::equal(previousObject.position, previousObject.position + 3, object.position)
+			|| !std::equal(previousObject.scale, previousObject.scale + 3, object.scale);
+		if (geometryChanged || previousObject.material.emissionStrength > 0.0f || object.material.emissionStrength > 0.0f) {
+			refreshRequired = true;
+			return;
+		}
+		if (object.type == 0) return;
+
+		glm::vec3 position(object.position[0], object.position[1], object.position[2]);
+		glm::vec3 halfSize = object.type == 1 ? glm::vec3(object.scale[0]) : glm::vec3(object.scale[0], object.scale[1], object.scale[2]) / 2.0f;
+		invalidateBounds(position - halfSize, position + halfSize);
+	}
+
+	// Lights don't affect anything beyond their reach
+	void invalidateLight(const Scene::PointLight& light) {
+		glm::vec3 position(light.position[0], light.position[1], light.position[2]);
+		float extent = light.reach + light.radius;
+		invalidateBounds(position - glm::vec3(extent), position + glm::vec3(extent));
+	}
+
+	bool pending() {
+		return hasRegion;
+	}
+
+	// Returns the pending region in pixels of a render of the given size (min corner inclusive, max corner exclusive) and forgets it.
+	// A pixel of margin covers the camera jitter.
+	glm::ivec4 takeRegion(int width, int height) {
+		glm::ivec4 region(0);
+		if (hasRegion) {
+			region.x = std::max((int)std::floor(regionMin.x * width) - 1, 0);
+			region.y = std::max((int)std::floor(regionMin.y * height) - 1, 0);
+			region.z = std::min((int)std::ceil(regionMax.x * width) + 1, width);
+			region.w = std::min((int)std::ceil(regionMax.y * height) + 1, height);
+		}
+
+		hasRegion = false;
+		return region;
+	}
+
+	void clear() {
+		hasRegion = false;
+	}
+}
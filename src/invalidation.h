@@ -0,0 +1,21 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "scene.h"
+
+// Tracks which part of the screen an edit can change, so that only the accumulation of those pixels is discarded.
+// The edited bounds are projected with the current camera. Anything that can't be bounded (emissive objects, objects that moved or changed
+// shape, whose shadows and reflections can land anywhere, bounds around the camera) falls back to a full reset, as does every edit when
+// regional resets are disabled.
+namespace Invalidation {
+	extern bool regional; // When disabled, every edit resets the whole accumulation
+	extern float margin; // World space distance the edited bounds are grown by, to also cover the light a changed material bounces onto its surroundings. 0 disables it.
+
+	void invalidateBounds(glm::vec3 boundsMin, glm::vec3 boundsMax);
+	void invalidateObject(const Scene::Object& previousObject, const Scene::Object& object);
+	void invalidateLight(const Scene::PointLight& light);
+	bool pending();
+	glm::ivec4 takeRegion(int width, int height);
+	void clear();
+}
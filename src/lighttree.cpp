@@ -0,0 +1,88 @@
+#include "lighttree.h"
+
+#include <algorithm>
+#include <glm/glm.hpp>
+
+namespace LightTree {
+	std::vector<Node> nodes;
+	GLuint nodeBuffer;
+
+	// Light indices, reordered during the build so that every node covers a contiguous range
+	std::vector<int> lightIndices;
+
+	glm::vec3 lightPosition(const Scene::PointLight& light) {
+		return glm::vec3(light.position[0], light.position[1], light.position[2]);
+	}
+
+	// Same weights as the luminance used by the shaders
+	float lightPower(const Scene::PointLight& light) {
+		return std::max(0.2126f * light.color[0] + 0.7152f * light.color[1] + 0.0722f * light.color[2], 0.0f) * std::max(light.power, 0.0f);
+	}
+
+	// Fills in the node covering lightIndices[first, first + count) and creates its children. Lights are split in two halves along the longest axis, which keeps the tree balanced.
+	void subdivide(const std::vector<Scene::PointLight>& lights, int nodeIndex, int first, int count) {
+		glm::vec3 boundsMin = lightPosition(lights[lightIndices[first]]) - glm::vec3(lights[lightIndices[first]].radius);
+		glm::vec3 boundsMax = lightPosition(lights[lightIndices[first]]) + glm::vec3(lights[lightIndices[first]].radius);
+		float power = 0.0f, reach = 0.0f;
+		for (int i = first; i < first + count; i++) {
+			const Scene::PointLight& light = lights[lightIndices[i]];
+			boundsMin = glm::min(boundsMin, lightPosition(light) - glm::vec3(light.radius));
+			boundsMax = glm::max(boundsMax, lightPosition(light) + glm::vec3(light.radius));
+			power += lightPower(light);
+			reach = std::max(reach, light.reach);
+		}
+
+		Node& node = nodes[nodeIndex];
+		for (int i = 0; i < 3; i++) {
+			node.boundsMin[i] = boundsMin[i];
+			node.boundsMax[i] = boundsMax[i];
+		}
+		node.power = power;
+		node.reach = reach;
+
+		if (count == 1) {
+			node.leftFirst = lightIndices[first];
+			node.lightCount = 1;
+			return;
+		}
+
+		glm::vec3 extent = boundsMax - boundsMin;
+		int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+		int leftCount = count / 2;
+		std::nth_element(lightIndices.begin() + first, lightIndices.begin() + first + leftCount, lightIndices.begin() + first + count, [&](int a, int b) {
+			return lights[a].position[axis] < lights[b].position[axis];
+		});
+
+		// node is not used past this point: the push_backs may reallocate
+		int leftIndex = (int)nodes.size();
+		nodes[nodeIndex].leftFirst = leftIndex;
+		nodes[nodeIndex].lightCount = 0;
+		nodes.push_back(Node());
+		nodes.push_back(Node());
+
+		subdivide(lights, leftIndex, first, leftCount);
+		subdivide(lights, leftIndex + 1, first + leftCount, count - leftCount);
+	}
+
+	void build(const std::vector<Scene::PointLight>& lights) {
+		lightIndices.resize(lights.size());
+		for (int i = 0; i < lights.size(); i++) lightIndices[i] = i;
+
+		nodes.clear();
+		nodes.reserve(std::max<size_t>(lights.size() * 2, 1));
+		nodes.push_back(Node());
+
+		// An empty tree is a root with no lights and no children, which the shaders check for before selecting a light
+		if (lights.empty()) return;
+
+		subdivide(lights, 0, 0, (int)lights.size());
+	}
+
+	void upload() {
+		if (!nodeBuffer) glGenBuffers(1, &nodeBuffer);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, nodeBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, nodes.size() * sizeof(Node), nodes.data(), GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 10, nodeBuffer); // Binding 10 = LightTreeBuffer in common.glsl
+	}
+}
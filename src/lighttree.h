@@ -0,0 +1,26 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <vector>
+
+#include "scene.h"
+
+namespace LightTree {
+	// Flattened node, uploaded as-is to the light tree SSBO. Must match LightTreeNode in common.glsl.
+	struct Node {
+		float boundsMin[3];
+		int leftFirst; // Interior nodes: index of the left child (the right child directly follows it). Leaves: index of the light.
+		float boundsMax[3];
+		int lightCount; // 1 for leaves, 0 for interior nodes
+		float power; // Summed luminance times power of every light below the node
+		float reach; // Largest reach of the lights below the node
+	};
+
+	static_assert(sizeof(Node) == 10 * sizeof(float), "LightTree::Node no longer matches the std430 layout of LightTreeNode");
+
+	extern std::vector<Node> nodes;
+	extern GLuint nodeBuffer;
+
+	void build(const std::vector<Scene::PointLight>& lights);
+	void upload();
+}
@@ -8,10 +8,23 @@
 #include <fstream>
 #include <sstream>
 #include <vector>
+#include <chrono>
+#include <cstdlib>
 
 #include "gui.h"
 #include "scene.h"
 #include "animation.h"
+#include "shader.h"
+#include "wavefront.h"
+#include "accumulation.h"
+#include "governor.h"
+#include "invalidation.h"
+#include "headless.h"
+#include "bloom.h"
+#include "profiler.h"
+#include "capture.h"
+#include "imagewriter.h"
+#include "framestream.h"
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -41,17 +54,23 @@ const GLfloat UVs[] = {
 };
 
 int screenWidth = 1920, screenHeight = 1080;
+float renderScale = 1.0f; // Fraction of the screen's width and height the accumulation passes render, below 1 while previewing
 GLuint shaderProgram;
-GLuint screenTexture;
 bool mouseAbsorbed = false;
-bool refreshRequired = false;
+bool refreshRequired = true; // Also makes the first frame record the geometry and object IDs
+bool cameraMoved = false; // Like refreshRequired, but the accumulation may be reprojected instead of discarded
 
 glm::mat4 rotationMatrix(1);
 glm::vec3 forwardVector(0, 0, -1);
 
-GLuint directOutPassUniformLocation, accumulatedPassesUniformLocation, timeUniformLocation, camPosUniformLocation, rotationMatrixUniformLocation, aspectRatioUniformLocation, debugKeyUniformLocation;
+GLuint directOutPassUniformLocation, accumulatedPassesUniformLocation, timeUniformLocation, camPosUniformLocation, rotationMatrixUniformLocation, aspectRatioUniformLocation, debugKeyUniformLocation, lightBouncesUniformLocation, renderScaleUniformLocation;
+GLuint reprojectionPassUniformLocation, historyValidUniformLocation, previousCamPosUniformLocation, previousRotationMatrixUniformLocation, resetRegionUniformLocation, cameraUnchangedUniformLocation;
 
-GLuint fbo;
+// Camera the geometry in the current accumulation target was recorded with, if any
+bool geometryValid = false;
+glm::vec3 geometryCameraPosition;
+glm::mat4 geometryRotationMatrix;
+glm::ivec2 geometryRenderSize;
 
 void renderAnimation(GLFWwindow* window, glm::vec3 posA, float yawA, float pitchA, glm::vec3 posB, float yawB, float pitchB, int frames, int framePasses, int* renderedFrames=nullptr);
 
@@ -61,8 +80,7 @@ void framebufferSizeCallback(GLFWwindow* window, int width, int height)
 	screenWidth = width;
 	screenHeight = height;
 
-	glBindTexture(GL_TEXTURE_2D, screenTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, screenWidth, screenHeight, 0, GL_RGBA, GL_FLOAT, NULL);
+	Accumulation::allocate(screenWidth, screenHeight);
 
 	refreshRequired = true;
 }
@@ -76,7 +94,7 @@ void mousebuttonCallback(GLFWwindow* window, int button, int action, int mods) {
 			Scene::mousePlace(mouseX, mouseY, screenWidth, screenHeight, Scene::cameraPosition, rotationMatrix);
 		}
 		else {
-			Scene::selectHovered(mouseX, mouseY, screenWidth, screenHeight, Scene::cameraPosition, rotationMatrix);
+			Scene::selectHovered((int)(mouseX * renderScale), (int)((screenHeight - mouseY) * renderScale));
 		}
 	}
 }
@@ -103,99 +121,10 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods
 	}
 }
 
-// Loads the shader source from disk, replaces the constants and returns a new OpenGL Program
-GLuint createShaderProgram(const char* vertex_file_path, const char* fragment_file_path) {
-
-	// Create the shaders
-	GLuint VertexShaderID = glCreateShader(GL_VERTEX_SHADER);
-	GLuint FragmentShaderID = glCreateShader(GL_FRAGMENT_SHADER);
-
-	// Read the Vertex Shader code from the file
-	std::string VertexShaderCode;
-	std::ifstream VertexShaderStream(vertex_file_path, std::ios::in);
-	if (VertexShaderStream.is_open()) {
-		std::stringstream sstr;
-		sstr << VertexShaderStream.rdbuf();
-		VertexShaderCode = sstr.str();
-		VertexShaderStream.close();
-	}
-	else {
-		printf("Unable to open %s.\n", vertex_file_path);
-		return 0;
-	}
-
-	// Read the Fragment Shader code from the file
-	std::string FragmentShaderCode;
-	std::ifstream FragmentShaderStream(fragment_file_path, std::ios::in);
-	if (FragmentShaderStream.is_open()) {
-		std::stringstream sstr;
-		sstr << FragmentShaderStream.rdbuf();
-		FragmentShaderCode = sstr.str();
-		FragmentShaderStream.close();
-	}
-
-	GLint Result = GL_FALSE;
-	int InfoLogLength;
-
-	// Compile Vertex Shader
-	printf("Compiling shader : %s\n", vertex_file_path);
-	char const* VertexSourcePointer = VertexShaderCode.c_str();
-	glShaderSource(VertexShaderID, 1, &VertexSourcePointer, NULL);
-	glCompileShader(VertexShaderID);
-
-	// Check Vertex Shader
-	glGetShaderiv(VertexShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(VertexShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if (InfoLogLength > 0) {
-		std::vector<char> VertexShaderErrorMessage(InfoLogLength + 1);
-		glGetShaderInfoLog(VertexShaderID, InfoLogLength, NULL, &VertexShaderErrorMessage[0]);
-		printf("%s\n", &VertexShaderErrorMessage[0]);
-	}
-
-	// Compile Fragment Shader
-	printf("Compiling shader : %s\n", fragment_file_path);
-	char const* FragmentSourcePointer = FragmentShaderCode.c_str();
-	glShaderSource(FragmentShaderID, 1, &FragmentSourcePointer, NULL);
-	glCompileShader(FragmentShaderID);
-
-	// Check Fragment Shader
-	glGetShaderiv(FragmentShaderID, GL_COMPILE_STATUS, &Result);
-	glGetShaderiv(FragmentShaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if (InfoLogLength > 0) {
-		std::vector<char> FragmentShaderErrorMessage(InfoLogLength + 1);
-		glGetShaderInfoLog(FragmentShaderID, InfoLogLength, NULL, &FragmentShaderErrorMessage[0]);
-		printf("%s\n", &FragmentShaderErrorMessage[0]);
-	}
-
-	// Link the program
-	printf("Linking program\n");
-	GLuint ProgramID = glCreateProgram();
-	glAttachShader(ProgramID, VertexShaderID);
-	glAttachShader(ProgramID, FragmentShaderID);
-	glLinkProgram(ProgramID);
-
-	// Check the program
-	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
-	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
-	if (InfoLogLength > 0) {
-		std::vector<char> ProgramErrorMessage(InfoLogLength + 1);
-		glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
-		printf("%s\n", &ProgramErrorMessage[0]);
-	}
-
-	glDetachShader(ProgramID, VertexShaderID);
-	glDetachShader(ProgramID, FragmentShaderID);
-
-	glDeleteShader(VertexShaderID);
-	glDeleteShader(FragmentShaderID);
-
-	return ProgramID;
-}
-
 // Uses createShaderProgram to create a program with the correct constants depending on the Scene and reassigns everything that needs to be. If a program already exists, it is deleted.
 void recompileShader() {
 	if (shaderProgram) glDeleteProgram(shaderProgram);
-	shaderProgram = createShaderProgram("shaders\\vertex.glsl", "shaders\\fragment.glsl");
+	shaderProgram = createShaderProgram("shaders/vertex.glsl", "shaders/fragment.glsl");
 	glUseProgram(shaderProgram);
 	Scene::bind(shaderProgram);
 
@@ -206,9 +135,22 @@ void recompileShader() {
 	rotationMatrixUniformLocation = glGetUniformLocation(shaderProgram, "u_rotationMatrix");
 	aspectRatioUniformLocation = glGetUniformLocation(shaderProgram, "u_aspectRatio");
 	debugKeyUniformLocation = glGetUniformLocation(shaderProgram, "u_debugKeyPressed");
+	lightBouncesUniformLocation = glGetUniformLocation(shaderProgram, "u_lightBounces");
+	renderScaleUniformLocation = glGetUniformLocation(shaderProgram, "u_renderScale");
+	glUniform2f(renderScaleUniformLocation, 1.0f, 1.0f);
+	reprojectionPassUniformLocation = glGetUniformLocation(shaderProgram, "u_reprojectionPass");
+	historyValidUniformLocation = glGetUniformLocation(shaderProgram, "u_historyValid");
+	previousCamPosUniformLocation = glGetUniformLocation(shaderProgram, "u_previousCameraPosition");
+	previousRotationMatrixUniformLocation = glGetUniformLocation(shaderProgram, "u_previousRotationMatrix");
+	resetRegionUniformLocation = glGetUniformLocation(shaderProgram, "u_resetRegion");
+	cameraUnchangedUniformLocation = glGetUniformLocation(shaderProgram, "u_cameraUnchanged");
 
 	glUniform1i(glGetUniformLocation(shaderProgram, "u_screenTexture"), 0);
 	glUniform1i(glGetUniformLocation(shaderProgram, "u_skyboxTexture"), 1);
+	glUniform1i(glGetUniformLocation(shaderProgram, "u_momentsTexture"), 4);
+	glUniform1i(glGetUniformLocation(shaderProgram, "u_geometryTexture"), 5);
+	glUniform1i(glGetUniformLocation(shaderProgram, "u_objectIdTexture"), 7);
+	glUniform1i(glGetUniformLocation(shaderProgram, "u_bloomTexture"), BLOOM_TEXTURE_UNIT);
 }
 
 float* load_image_data(char const* filename, int* x, int* y, int* channels_in_file, int desired_channels) {
@@ -281,31 +223,50 @@ bool handleMovementInput(GLFWwindow* window, double deltaTime, glm::vec3& camera
 	return moved;
 }
 
-// Source: https://lencerf.github.io/post/2019-09-21-save-the-opengl-rendering-to-image-file/
-void saveImage(GLFWwindow* w, int accumulatedPasses, const char* filepath) {
-	int width, height;
-	glfwGetFramebufferSize(w, &width, &height);
-	GLsizei nrChannels = 3;
-	GLsizei stride = nrChannels * width;
-	stride += (stride % 4) ? (4 - stride % 4) : 0;
-	GLsizei bufferSize = stride * height;
-	float* floatBuffer = new float[bufferSize];
-	glPixelStorei(GL_PACK_ALIGNMENT, 4);
-	glReadBuffer(GL_FRONT);
-	glReadPixels(0, 0, width, height, GL_RGB, GL_FLOAT, floatBuffer);
-
-	unsigned char* byteBuffer = new unsigned char[bufferSize];
-	for (int i = 0; i < bufferSize; i++) byteBuffer[i] = (unsigned char)(std::min(floatBuffer[i] / accumulatedPasses, 1.0f) * 255);
-
-	stbi_flip_vertically_on_write(true);
-	stbi_write_png(filepath, width, height, nrChannels, byteBuffer, stride);
-
-	delete[] floatBuffer;
-	delete[] byteBuffer;
+// Replaces the accumulation with what is still visible of it from the current camera (the uniforms must already be set), and records the geometry the next reprojection will need
+// along with the object seen through every pixel. With keepHistory false, the accumulation is cleared instead, and only the pixels inside resetRegion are cleared otherwise.
+// If the camera hasn't changed, the pixels outside the reset region are copied unchanged, so that recording the geometry and objects never costs them their history.
+void reprojectAccumulation(bool keepHistory, glm::ivec4 resetRegion, int renderWidth, int renderHeight, glm::vec3 cameraPosition, glm::mat4 rotationMatrix) {
+	bool cameraUnchanged = cameraPosition == geometryCameraPosition && rotationMatrix == geometryRotationMatrix && glm::ivec2(renderWidth, renderHeight) == geometryRenderSize;
+	glUniform1i(historyValidUniformLocation, keepHistory && geometryValid);
+	glUniform4i(resetRegionUniformLocation, resetRegion.x, resetRegion.y, resetRegion.z, resetRegion.w);
+	glUniform1i(cameraUnchangedUniformLocation, cameraUnchanged);
+	glUniform3f(previousCamPosUniformLocation, geometryCameraPosition.x, geometryCameraPosition.y, geometryCameraPosition.z);
+	glUniformMatrix4fv(previousRotationMatrixUniformLocation, 1, GL_FALSE, glm::value_ptr(geometryRotationMatrix));
+	glUniform2f(renderScaleUniformLocation, (float)renderWidth / screenWidth, (float)renderHeight / screenHeight);
+
+	Profiler::beginStage(Profiler::STAGE_REPROJECTION);
+	Accumulation::beginPass();
+	glUniform1i(reprojectionPassUniformLocation, 1);
+	glDrawArrays(GL_TRIANGLES, 0, 6);
+	glUniform1i(reprojectionPassUniformLocation, 0);
+	Accumulation::endPass();
+	Profiler::endStage(Profiler::STAGE_REPROJECTION);
+
+	geometryValid = true;
+	geometryCameraPosition = cameraPosition;
+	geometryRotationMatrix = rotationMatrix;
+	geometryRenderSize = glm::ivec2(renderWidth, renderHeight);
+}
+
+// Opens the stream of an animation render, if its frames are streamed rather than saved to files
+bool beginAnimationOutput() {
+	if (Animation::outputFormat != FORMAT_STREAM) return true;
+	return FrameStream::open(Animation::streamTarget, Animation::streamFormat, Animation::frameRate);
+}
+
+// Hands every frame still being read back to ImageWriter. A stream is only closed once all of them have been written to it.
+void endAnimationOutput() {
+	Capture::flush();
+	if (FrameStream::isOpen()) {
+		ImageWriter::finish();
+		FrameStream::close();
+	}
 }
 
 void renderAnimation(GLFWwindow* window, glm::vec3 posA, float yawA, float pitchA, glm::vec3 posB, float yawB, float pitchB, int frames, int framePasses, int* renderedFrames) {
 	if (renderedFrames != nullptr) *renderedFrames = 0;
+	if (!beginAnimationOutput()) return;
 	
 	glUniform1i(glGetUniformLocation(shaderProgram, "u_framePasses"), framePasses);
 	for (int frame = 0; frame < frames; frame++) {
@@ -323,29 +284,238 @@ void renderAnimation(GLFWwindow* window, glm::vec3 posA, float yawA, float pitch
 		glUniformMatrix4fv(rotationMatrixUniformLocation, 1, GL_FALSE, glm::value_ptr(rotMatrix));
 		glUniform1f(aspectRatioUniformLocation, (float)screenWidth / screenHeight);
 
-		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+		Accumulation::beginPass();
 		glUniform1i(directOutPassUniformLocation, 0);
 		glUniform1i(accumulatedPassesUniformLocation, 0);
 		glDrawArrays(GL_TRIANGLES, 0, 6);
+		Accumulation::endPass();
 
-		saveImage(window, 1, std::string("anim\\").append(std::to_string(frame)).append(".png").c_str());
+		Capture::request(std::string("anim/").append(std::to_string(frame)).append(ImageWriter::formatExtensions[Animation::outputFormat]), Animation::outputFormat, frame);
 		if (renderedFrames != nullptr) *renderedFrames += 1;
 
 		std::cout << "Rendered frame " << frame << "/" << frames << std::endl;
 	}
+	endAnimationOutput();
 	glUniform1i(glGetUniformLocation(shaderProgram, "u_framePasses"), Scene::framePasses);
 }
 
-int main() {
+void createScreenQuad(GLuint* vertexArray, GLuint* vertexBuffer, GLuint* uvBuffer) {
+	glGenVertexArrays(1, vertexArray);
+	glBindVertexArray(*vertexArray);
+
+	glGenBuffers(1, vertexBuffer);
+	glGenBuffers(1, uvBuffer);
+
+	glBindBuffer(GL_ARRAY_BUFFER, *vertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glEnableVertexAttribArray(0);
+
+
+	glBindBuffer(GL_ARRAY_BUFFER, *uvBuffer);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(UVs), UVs, GL_STATIC_DRAW);
+
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glEnableVertexAttribArray(1);
+
+	glBindVertexArray(*vertexArray);
+}
+
+// Parameters of a --headless render, all of which can be set from the command line
+struct HeadlessJob {
+	std::string scene = "basic"; // basic, mirror or random, see procedural_scenes.h
+	std::string skybox = "skyboxes/kiara_9_dusk_2k.hdr";
+	int width = 1920, height = 1080;
+	int passes = 256;
+	int bounces = 5;
+	float adaptiveThreshold = 0.0f; // Unlike the interactive default, 0 so that every pixel gets all the passes asked for
+	std::string output = "render.png";
+	ImageFormat format = FORMAT_PNG; // Picked from the extension of output, FORMAT_STREAM when streaming
+	StreamFormat streamFormat = STREAM_Y4M;
+	bool wavefront = false;
+};
+
+void printUsage() {
+	std::cout << "Usage: opengl-raytracing [--headless [--scene basic|mirror|random] [--skybox <file>] [--width <pixels>] [--height <pixels>]" << std::endl;
+	std::cout << "                         [--passes <count>] [--bounces <count>] [--adaptive-threshold <error>]" << std::endl;
+	std::cout << "                         [--output <file.png|.hdr|.pfm|.exr>] [--wavefront]" << std::endl;
+	std::cout << "                         [--stream <pipe>|- [--stream-format rgb|rgba|y4m]]]" << std::endl;
+}
+
+bool parseHeadlessJob(int argc, char** argv, HeadlessJob& job) {
+	for (int i = 2; i < argc; i++) {
+		std::string option(argv[i]);
+		if (option == "--wavefront") {
+			job.wavefront = true;
+			continue;
+		}
+
+		if (i + 1 >= argc) {
+			std::cout << "Missing value for " << option << std::endl;
+			return false;
+		}
+		std::string value(argv[++i]);
+
+		if (option == "--scene") job.scene = value;
+		else if (option == "--skybox") job.skybox = value;
+		else if (option == "--output") job.output = value;
+		else if (option == "--stream") {
+			job.output = value;
+			job.format = FORMAT_STREAM;
+		}
+		else if (option == "--stream-format") {
+			if (value == "rgb") job.streamFormat = STREAM_RGB;
+			else if (value == "rgba") job.streamFormat = STREAM_RGBA;
+			else if (value == "y4m") job.streamFormat = STREAM_Y4M;
+			else {
+				std::cout << "Unknown stream format " << value << std::endl;
+				return false;
+			}
+		}
+		else if (option == "--width") job.width = std::atoi(value.c_str());
+		else if (option == "--height") job.height = std::atoi(value.c_str());
+		else if (option == "--passes") job.passes = std::atoi(value.c_str());
+		else if (option == "--bounces") job.bounces = std::atoi(value.c_str());
+		else if (option == "--adaptive-threshold") job.adaptiveThreshold = (float)std::atof(value.c_str());
+		else {
+			std::cout << "Unknown option " << option << std::endl;
+			return false;
+		}
+	}
+
+	if (job.scene != "basic" && job.scene != "mirror" && job.scene != "random") {
+		std::cout << "Unknown scene " << job.scene << std::endl;
+		return false;
+	}
+	if (job.format != FORMAT_STREAM && !ImageWriter::formatFromPath(job.output, job.format)) {
+		std::cout << "Unknown output format " << job.output << ", expected .png, .hdr, .pfm or .exr" << std::endl;
+		return false;
+	}
+	if (job.width <= 0 || job.height <= 0 || job.passes <= 0 || job.bounces <= 0) {
+		std::cout << "Width, height, passes and bounces must be positive" << std::endl;
+		return false;
+	}
+	if (job.adaptiveThreshold < 0.0f) {
+		std::cout << "The adaptive threshold can't be negative" << std::endl;
+		return false;
+	}
+	return true;
+}
+
+// Renders a job offscreen as fast as the GPU allows and writes the result. Nothing is presented, so neither swaps nor vsync slow it down.
+int renderHeadless(const HeadlessJob& job) {
+	// Opened first so that every message printed while setting up goes to stderr instead of into a stream on stdout
+	if (job.format == FORMAT_STREAM && !FrameStream::open(job.output, job.streamFormat, 1)) return -1;
+	if (!Headless::createContext()) {
+		FrameStream::close();
+		return -1;
+	}
+
+	glewExperimental = GL_TRUE; // Otherwise GLEW skips the functions of core profile contexts, which is what EGL creates
+	if (glewInit() != GLEW_OK) {
+		std::cout << "Failed to initialize GLEW!" << std::endl;
+		Headless::destroyContext();
+		FrameStream::close();
+		return -1;
+	}
+
+	if (job.scene == "mirror") placeMirrorSpheres();
+	else if (job.scene == "random") placeRandomSpheres();
+	else placeBasicScene();
+	Scene::lightBounces = job.bounces;
+	Scene::adaptiveThreshold = job.adaptiveThreshold;
+	Wavefront::enabled = job.wavefront;
+	recompileShader();
+
+	int sbWidth, sbHeight, sbChannels;
+	float* skyboxData = stbi_loadf(job.skybox.c_str(), &sbWidth, &sbHeight, &sbChannels, 3);
+	if (skyboxData) Scene::loadSkybox(skyboxData, sbWidth, sbHeight);
+	else std::cout << "Failed to load " << job.skybox << std::endl;
+	stbi_image_free(skyboxData);
+
+	GLuint vertexArray, vertexBuffer, uvBuffer;
+	createScreenQuad(&vertexArray, &vertexBuffer, &uvBuffer);
+
+	screenWidth = job.width;
+	screenHeight = job.height;
+	Accumulation::allocate(screenWidth, screenHeight);
+	glViewport(0, 0, screenWidth, screenHeight);
+	glDisable(GL_DEPTH_TEST);
+
+	rotationMatrix = glm::rotate(glm::rotate(glm::mat4(1), Scene::cameraPitch, glm::vec3(1, 0, 0)), Scene::cameraYaw, glm::vec3(0, 1, 0));
+	glUniform3f(camPosUniformLocation, Scene::cameraPosition.x, Scene::cameraPosition.y, Scene::cameraPosition.z);
+	glUniformMatrix4fv(rotationMatrixUniformLocation, 1, GL_FALSE, glm::value_ptr(rotationMatrix));
+	glUniform1f(aspectRatioUniformLocation, (float)screenWidth / screenHeight);
+	glUniform1i(directOutPassUniformLocation, 0);
+
+	std::cout << "Rendering " << job.passes << " passes at " << screenWidth << "x" << screenHeight << std::endl;
+	std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+	for (int pass = 0; pass < job.passes; pass++) {
+		float time = 1.0f + (float)pass * Scene::framePasses; // Every sample of a pass adds 1 to its seed, so later passes must not reuse them
+
+		if (Wavefront::enabled) {
+			Wavefront::render(screenWidth, screenHeight, 0, screenHeight, Scene::lightBounces, pass, time, Scene::cameraPosition, rotationMatrix, pass == 0);
+		}
+		else {
+			Accumulation::beginPass();
+			glUniform1f(timeUniformLocation, time);
+			glUniform1i(accumulatedPassesUniformLocation, pass);
+			glDrawArrays(GL_TRIANGLES, 0, 6);
+			Accumulation::endPass();
+		}
+		if (Scene::adaptiveThreshold > 0.0f) Scene::updateConvergence(screenWidth * screenHeight);
+
+		if ((pass + 1) % std::max(job.passes / 10, 1) == 0) std::cout << "Queued pass " << pass + 1 << "/" << job.passes << std::endl;
+	}
+	glFinish();
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+	std::cout << "Rendered " << job.passes << " passes in " << seconds << "s (" << job.passes / seconds << " passes/s)" << std::endl;
+	if (Scene::adaptiveThreshold > 0.0f) std::cout << "Adaptive sampling skipped " << Scene::convergedFraction * 100.0f << "% of the pixels in the last passes" << std::endl;
+
+	// The accumulation targets hold the mean of the passes, which is what the display pass shows before adding bloom
+	Capture::request(job.output, job.format);
+	Capture::cleanup();
+	ImageWriter::shutdown();
+	FrameStream::close();
+	std::cout << (job.format == FORMAT_STREAM ? "Streamed to " : "Saved ") << job.output << std::endl;
+
+	glDeleteBuffers(1, &vertexBuffer);
+	glDeleteBuffers(1, &uvBuffer);
+	glDeleteVertexArrays(1, &vertexArray);
+	glDeleteProgram(shaderProgram);
+	Accumulation::cleanup();
+	Wavefront::cleanup();
+	Headless::destroyContext();
+
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1) {
+		HeadlessJob job;
+		if (std::string(argv[1]) != "--headless" || !parseHeadlessJob(argc, argv, job)) {
+			printUsage();
+			return -1;
+		}
+		return renderHeadless(job);
+	}
+
+	// When stdout is piped, an animation may stream to it, so nothing else must have been written to it before
+	if (!FrameStream::stdoutIsTerminal()) FrameStream::reserveStdout();
+
 	std::cout << "Loading skybox" << std::endl;
 	int sbWidth, sbHeight, sbChannels;
-	float* skyboxData = stbi_loadf("skyboxes\\kiara_9_dusk_2k.hdr", &sbWidth, &sbHeight, &sbChannels, 0);
+	float* skyboxData = stbi_loadf("skyboxes/kiara_9_dusk_2k.hdr", &sbWidth, &sbHeight, &sbChannels, 3);
 
 	if (!glfwInit()) {
 		std::cout << "Failed to initialize GLFW!" << std::endl;
 		return -1;
 	}
 
+#ifdef HEADLESS_EGL
+	glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_EGL_CONTEXT_API); // GLEW is built for EGL in this configuration, so the window's context must come from EGL as well
+#endif
 	GLFWwindow* programWindow = glfwCreateWindow(screenWidth, screenHeight, "OpenGL Raytracing", NULL, NULL);
 
 	if (!programWindow) {
@@ -371,58 +541,20 @@ int main() {
 
 	GUI::init(programWindow);
 
-	glGenTextures(1, &Scene::skyboxTexture);
-	glActiveTexture(GL_TEXTURE1);
-	glBindTexture(GL_TEXTURE_2D, Scene::skyboxTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, sbWidth, sbHeight, 0, GL_RGB, GL_FLOAT, skyboxData);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
+	if (skyboxData) Scene::loadSkybox(skyboxData, sbWidth, sbHeight);
+	else std::cout << "Failed to load skyboxes/kiara_9_dusk_2k.hdr" << std::endl;
 	stbi_image_free(skyboxData);
 
-	GLuint vertexArray;
-	glGenVertexArrays(1, &vertexArray);
-	glBindVertexArray(vertexArray);
-	
-	GLuint vertexBuffer;
-	glGenBuffers(1, &vertexBuffer);
-
-	GLuint uvBuffer;
-	glGenBuffers(1, &uvBuffer);
-
-	glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
-
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
-	glEnableVertexAttribArray(0);
-
+	GLuint vertexArray, vertexBuffer, uvBuffer;
+	createScreenQuad(&vertexArray, &vertexBuffer, &uvBuffer);
 
-	glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(UVs), UVs, GL_STATIC_DRAW);
-
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
-	glEnableVertexAttribArray(1);
-
-	glBindVertexArray(vertexArray);
-
-	glGenTextures(1, &screenTexture);
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, screenTexture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, screenWidth, screenHeight, 0, GL_RGBA, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-	glGenFramebuffers(1, &fbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, screenTexture, 0);
-
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-		std::cout << "ERROR: Framebuffer is not complete!" << std::endl;
-		return -1;
-	}
+	Accumulation::allocate(screenWidth, screenHeight);
 
 	glUniform1i(glGetUniformLocation(shaderProgram, "u_screenTexture"), 0);
 	glUniform1i(glGetUniformLocation(shaderProgram, "u_skyboxTexture"), 1);
+	glUniform1i(glGetUniformLocation(shaderProgram, "u_momentsTexture"), 4);
+	glUniform1i(glGetUniformLocation(shaderProgram, "u_geometryTexture"), 5);
+	glUniform1i(glGetUniformLocation(shaderProgram, "u_objectIdTexture"), 7);
 
 	glViewport(0, 0, screenWidth, screenHeight);
 	glDisable(GL_DEPTH_TEST);
@@ -430,12 +562,18 @@ int main() {
 	double deltaTime = 0.0f;
 	int freezeCounter = 0;
 	int accumulatedPasses = 0;
+	double lastMovementTime = -1000.0;
+	bool previewing = false;
 	while (!glfwWindowShouldClose(programWindow) && !GUI::shouldQuit) {
 		double preTime = glfwGetTime();
 		glfwPollEvents();
+		Profiler::beginFrame();
 
 		if (Animation::currentlyRenderingAnimation) {
-			if (Animation::currentFrame == -1) Animation::currentFrame = 0; // Setting currentFrame to -1 ensures we don't start writing frames before this code has been called.
+			if (Animation::currentFrame == -1) { // Setting currentFrame to -1 ensures we don't start writing frames before this code has been called.
+				Animation::currentFrame = 0;
+				if (!beginAnimationOutput()) Animation::currentlyRenderingAnimation = false;
+			}
 
 			Scene::cameraPosition = Animation::calculateCurrentCameraPosition();
 			glm::vec2 cameraOrientation = Animation::calculateCurrentCameraOrientation();
@@ -446,7 +584,8 @@ int main() {
 		else {
 			if (mouseAbsorbed) {
 				if (handleMovementInput(programWindow, deltaTime, Scene::cameraPosition, Scene::cameraYaw, Scene::cameraPitch, &rotationMatrix)) {
-					refreshRequired = true;
+					cameraMoved = true;
+					lastMovementTime = preTime;
 				}
 			}
 			else {
@@ -458,35 +597,119 @@ int main() {
 			glUniform1i(debugKeyUniformLocation, glfwGetKey(programWindow, GLFW_KEY_F));
 		}
 
-		if (refreshRequired) {
+		// Dynamic resolution: while the camera moves, passes render a smaller image with fewer bounces, which the display pass upscales
+		bool previewRequired = Scene::previewEnabled && !Animation::currentlyRenderingAnimation && (preTime - lastMovementTime) * 1000.0 < Scene::previewDelay;
+		if (previewRequired != previewing) {
+			previewing = previewRequired;
+			refreshRequired = true;
+		}
+		renderScale = previewing ? Scene::previewScale : 1.0f;
+		int renderWidth = std::max(1, (int)(screenWidth * renderScale));
+		int renderHeight = std::max(1, (int)(screenHeight * renderScale));
+		int lightBounces = previewing ? std::min(Scene::previewBounces, Scene::lightBounces) : Scene::lightBounces;
+		glUniform1i(lightBouncesUniformLocation, lightBounces);
+
+		glUniform3f(camPosUniformLocation, Scene::cameraPosition.x, Scene::cameraPosition.y, Scene::cameraPosition.z);
+		glUniformMatrix4fv(rotationMatrixUniformLocation, 1, GL_FALSE, glm::value_ptr(rotationMatrix));
+		glUniform1f(aspectRatioUniformLocation, (float)screenWidth / screenHeight);
+
+		bool refreshed = refreshRequired || cameraMoved;
+		if (refreshed) {
 			accumulatedPasses = 0;
+			Governor::restartPass();
+
+			// When only the camera moved, the pixels that still see the same surface keep their samples. Anything else changes what every pixel shows.
+			// The pass runs either way, as it also records the object IDs the selection outline and picking read.
+			bool keepHistory = !refreshRequired && Scene::reprojectionEnabled && !Animation::currentlyRenderingAnimation;
+			glViewport(0, 0, renderWidth, renderHeight);
+			reprojectAccumulation(keepHistory, glm::ivec4(0), renderWidth, renderHeight, Scene::cameraPosition, rotationMatrix);
+			accumulatedPasses = 1; // Makes the passes that follow read the reprojected accumulation, pixels that lost theirs hold 0 passes
+
 			refreshRequired = false;
+			cameraMoved = false;
 			glUniform1i(accumulatedPassesUniformLocation, accumulatedPasses); // If the shader receives a value of 0 for accumulatedPasses, it will discard the buffer and just output what it rendered on that frame.
 		}
 
+		// Edits that can only change part of the screen discard the accumulation of that part. The pass in progress starts over, as some of its bands may show the scene from before the edit.
+		// The reprojection pass applies the region with an unchanged camera, which also records the geometry and objects now seen through it and leaves the rest of the accumulation untouched.
+		// Scene::reprojectionEnabled only concerns camera moves, so it doesn't apply here.
+		if (refreshed) {
+			Invalidation::clear();
+		}
+		else if (Invalidation::pending()) {
+			glm::ivec4 region = Invalidation::takeRegion(renderWidth, renderHeight);
+			Governor::restartPass();
 
-		glUniform1f(timeUniformLocation, (float)preTime);
-		glUniform3f(camPosUniformLocation, Scene::cameraPosition.x, Scene::cameraPosition.y, Scene::cameraPosition.z);
-		glUniformMatrix4fv(rotationMatrixUniformLocation, 1, GL_FALSE, glm::value_ptr(rotationMatrix));
-		glUniform1f(aspectRatioUniformLocation, (float)screenWidth / screenHeight);
+			glViewport(0, 0, renderWidth, renderHeight);
+			reprojectAccumulation(true, region, renderWidth, renderHeight, Scene::cameraPosition, rotationMatrix);
+		}
 
-		// Step 1: render to FBO
-		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-		glUniform1i(directOutPassUniformLocation, 0);
-		glDrawArrays(GL_TRIANGLES, 0, 6);
-		accumulatedPasses += 1;
+		// Step 1: render bands of the accumulation pass into the accumulation target (the wavefront backend updates the current one in place), as many as the frame budget allows.
+		// With the fragment backend, a pass only becomes visible once all of its bands are done. The wavefront backend adds each band to the displayed target as it goes,
+		// which still shows a valid mean since every pixel counts its own passes. Animations count their passes per presented frame, so they keep rendering whole passes one at a time.
+		bool navigating = mouseAbsorbed || refreshed || ImGui::GetIO().WantCaptureMouse;
+		int unitCount = Animation::currentlyRenderingAnimation ? 1 : Governor::unitCount(navigating, renderWidth, renderHeight);
+		int renderedRows = 0;
+		glViewport(0, 0, renderWidth, renderHeight);
+		Profiler::beginStage(Profiler::STAGE_ACCUMULATION);
+		for (int unit = 0; unit < unitCount; unit++) {
+			if (Governor::band == 0) Governor::planBands(renderWidth, renderHeight, !Animation::currentlyRenderingAnimation);
+			int rowStart = Governor::bandStart(Governor::band, renderHeight);
+			int rowCount = Governor::bandStart(Governor::band + 1, renderHeight) - rowStart;
+			float time = (float)preTime + unit * Scene::framePasses; // Every sample of a pass adds 1 to its seed, so later passes must not reuse them
+
+			Governor::beginUnit(renderWidth * rowCount);
+			if (Wavefront::enabled) {
+				Wavefront::render(renderWidth, renderHeight, rowStart, rowCount, lightBounces, accumulatedPasses, time, Scene::cameraPosition, rotationMatrix, refreshed && unit == 0);
+			}
+			else {
+				Accumulation::beginPass();
+				glEnable(GL_SCISSOR_TEST);
+				glScissor(0, rowStart, renderWidth, rowCount);
+				glUniform1f(timeUniformLocation, time);
+				glUniform1i(accumulatedPassesUniformLocation, accumulatedPasses);
+				glUniform1i(directOutPassUniformLocation, 0);
+				glDrawArrays(GL_TRIANGLES, 0, 6);
+				glDisable(GL_SCISSOR_TEST);
+			}
+			Governor::endUnit();
+			renderedRows += rowCount;
 
-		// Step 2: render to screen
+			if (++Governor::band == Governor::bands) {
+				Governor::band = 0;
+				if (!Wavefront::enabled) Accumulation::endPass();
+				accumulatedPasses += 1;
+			}
+		}
+		Profiler::endStage(Profiler::STAGE_ACCUMULATION);
+		if (Scene::adaptiveThreshold > 0.0f) Scene::updateConvergence(renderWidth * renderedRows);
+
+		// Step 2: render to screen, with the bloom computed from what was accumulated so far
+		Profiler::beginStage(Profiler::STAGE_BLOOM);
+		Bloom::render((float)renderWidth / screenWidth, (float)renderHeight / screenHeight);
+		Profiler::endStage(Profiler::STAGE_BLOOM);
+		Profiler::beginStage(Profiler::STAGE_DISPLAY);
+		glViewport(0, 0, screenWidth, screenHeight);
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		glUniform2f(renderScaleUniformLocation, (float)renderWidth / screenWidth, (float)renderHeight / screenHeight);
 		glUniform1i(directOutPassUniformLocation, 1);
 		glUniform1i(accumulatedPassesUniformLocation, accumulatedPasses);
 		glDrawArrays(GL_TRIANGLES, 0, 6);
+		Profiler::endStage(Profiler::STAGE_DISPLAY);
 
-		if (!mouseAbsorbed && !Animation::currentlyRenderingAnimation) GUI::render();
+		if (!mouseAbsorbed && !Animation::currentlyRenderingAnimation) {
+			Profiler::beginStage(Profiler::STAGE_GUI);
+			GUI::render();
+			Profiler::endStage(Profiler::STAGE_GUI);
+		}
 
 		glfwSwapBuffers(programWindow);
 
 		deltaTime = glfwGetTime() - preTime;
+
+		// Every sample traces a camera or bounce ray and the shadow rays of each bounce, except for the paths that end early
+		double rays = (double)renderWidth * renderedRows * Scene::framePasses * lightBounces * (1 + Scene::shadowRays);
+		Profiler::endFrame((float)(deltaTime * 1000.0), rays, lightBounces, Scene::shadowRays);
 		if (deltaTime > 1.0F) {
 			freezeCounter += 1;
 			if (freezeCounter >= 2) {
@@ -501,7 +724,7 @@ int main() {
 		// Because Animation::currentlyRenderingAnimation is set by the GUI, it will be true down here before it is caught above. This is why GUI will initially set the currentFrame to -1 so this code knows it must not do anything.
 		if (Animation::currentlyRenderingAnimation && Animation::currentFrame >= 0) {
 			if (Animation::currentPass >= Animation::framePasses - 1) {
-				saveImage(programWindow, 1, std::string("render_output\\").append(std::to_string(Animation::currentFrame)).append(".png").c_str());
+				Capture::request(std::string("render_output/").append(std::to_string(Animation::currentFrame)).append(ImageWriter::formatExtensions[Animation::outputFormat]), Animation::outputFormat, Animation::currentFrame);
 			
 				Animation::currentFrame++;
 				if (Animation::currentFrame >= Animation::totalFrameCount) {
@@ -515,16 +738,23 @@ int main() {
 			}
 
 			if (glfwGetKey(programWindow, GLFW_KEY_ESCAPE)) Animation::currentlyRenderingAnimation = false;
+			if (!Animation::currentlyRenderingAnimation) endAnimationOutput();
 		}
+		Capture::poll();
 	}
 
 	glDeleteBuffers(1, &vertexBuffer);
 	glDeleteBuffers(1, &uvBuffer);
 	glDeleteVertexArrays(1, &vertexArray);
 	glDeleteProgram(shaderProgram);
-	glDeleteFramebuffers(1, &fbo);
-	glDeleteTextures(1, &screenTexture);
-
+	Capture::cleanup();
+	ImageWriter::shutdown();
+	FrameStream::close();
+	Accumulation::cleanup();
+	Wavefront::cleanup();
+	Governor::cleanup();
+	Bloom::cleanup();
+	Profiler::cleanup();
 
 	GUI::cleanup();
 
@@ -0,0 +1,161 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+namespace Profiler {
+	const char* stageNames[STAGE_COUNT] = { "Reprojection", "Accumulation", "Bloom", "Display", "GUI" };
+	float stageMilliseconds[STAGE_COUNT] = {};
+	float gpuMilliseconds = 0.0f;
+	float cpuMilliseconds = 0.0f;
+	double raysPerSecond = 0.0;
+
+	bool logging = false;
+	char logPath[256] = "profile.csv";
+
+	struct Frame {
+		GLuint queries[STAGE_COUNT][2]; // Timestamps at the start and the end of each stage
+		bool recorded[STAGE_COUNT];
+		bool pending; // Queries issued but not collected yet
+		long long number;
+		float cpuMilliseconds;
+		double rays;
+		int lightBounces, shadowRays;
+	};
+
+	Frame frames[PROFILER_FRAMES];
+	int currentFrame = 0; // Slot of the frame being recorded
+	bool recording = false;
+	long long frameNumber = 0;
+	bool initialized = false;
+	std::ofstream logFile;
+
+	float smooth(float average, float value) {
+		return average > 0.0f ? average + (value - average) * PROFILER_SMOOTHING : value;
+	}
+
+	bool available(const Frame& frame) {
+		for (int stage = 0; stage < STAGE_COUNT; stage++) {
+			if (!frame.recorded[stage]) continue;
+
+			GLint result = 0;
+			glGetQueryObjectiv(frame.queries[stage][1], GL_QUERY_RESULT_AVAILABLE, &result);
+			if (!result) return false;
+		}
+		return true;
+	}
+
+	// Folds the frames the GPU has finished into the averages and the log, oldest first so that the log stays in order
+	void collect() {
+		for (int i = 1; i <= PROFILER_FRAMES; i++) {
+			Frame& frame = frames[(currentFrame + i) % PROFILER_FRAMES];
+			if (!frame.pending) continue;
+			if (!available(frame)) break;
+
+			float milliseconds[STAGE_COUNT] = {};
+			float total = 0.0f;
+			for (int stage = 0; stage < STAGE_COUNT; stage++) {
+				if (!frame.recorded[stage]) continue;
+
+				GLuint64 start = 0, end = 0;
+				glGetQueryObjectui64v(frame.queries[stage][0], GL_QUERY_RESULT, &start);
+				glGetQueryObjectui64v(frame.queries[stage][1], GL_QUERY_RESULT, &end);
+				milliseconds[stage] = end > start ? (end - start) / 1000000.0f : 0.0f;
+				total += milliseconds[stage];
+			}
+			frame.pending = false;
+
+			for (int stage = 0; stage < STAGE_COUNT; stage++) stageMilliseconds[stage] = smooth(stageMilliseconds[stage], milliseconds[stage]);
+			gpuMilliseconds = smooth(gpuMilliseconds, total);
+			cpuMilliseconds = smooth(cpuMilliseconds, frame.cpuMilliseconds);
+			double frameRaysPerSecond = milliseconds[STAGE_ACCUMULATION] > 0.0f ? frame.rays * 1000.0 / milliseconds[STAGE_ACCUMULATION] : 0.0;
+			if (frame.rays > 0.0) raysPerSecond = raysPerSecond > 0.0 ? raysPerSecond + (frameRaysPerSecond - raysPerSecond) * PROFILER_SMOOTHING : frameRaysPerSecond;
+
+			if (logging) {
+				logFile << frame.number << "," << frame.cpuMilliseconds;
+				for (int stage = 0; stage < STAGE_COUNT; stage++) logFile << "," << milliseconds[stage];
+				logFile << "," << total << "," << (long long)frame.rays << "," << (long long)frameRaysPerSecond << "," << frame.lightBounces << "," << frame.shadowRays << "\n";
+			}
+		}
+	}
+
+	// Starts recording a frame, unless the GPU is so far behind that its slot still holds results that haven't been collected
+	void beginFrame() {
+		if (!initialized) {
+			for (Frame& frame : frames) {
+				glGenQueries(STAGE_COUNT * 2, &frame.queries[0][0]);
+				frame.pending = false;
+			}
+			initialized = true;
+		}
+
+		collect();
+
+		Frame& frame = frames[currentFrame];
+		recording = !frame.pending;
+		for (int stage = 0; stage < STAGE_COUNT; stage++) frame.recorded[stage] = false;
+	}
+
+	// Stages that run more than once in a frame, or not at all, are only timed the first time
+	void beginStage(Stage stage) {
+		if (!recording || frames[currentFrame].recorded[stage]) return;
+		glQueryCounter(frames[currentFrame].queries[stage][0], GL_TIMESTAMP);
+	}
+
+	void endStage(Stage stage) {
+		if (!recording || frames[currentFrame].recorded[stage]) return;
+		glQueryCounter(frames[currentFrame].queries[stage][1], GL_TIMESTAMP);
+		frames[currentFrame].recorded[stage] = true;
+	}
+
+	// rays is the estimated number of rays the accumulation stage traced in this frame
+	void endFrame(float frameMilliseconds, double rays, int lightBounces, int shadowRays) {
+		if (!recording) return;
+
+		Frame& frame = frames[currentFrame];
+		frame.pending = true;
+		frame.number = frameNumber++;
+		frame.cpuMilliseconds = frameMilliseconds;
+		frame.rays = rays;
+		frame.lightBounces = lightBounces;
+		frame.shadowRays = shadowRays;
+
+		currentFrame = (currentFrame + 1) % PROFILER_FRAMES;
+		recording = false;
+	}
+
+	bool startLog() {
+		logFile.open(logPath);
+		if (!logFile) {
+			std::cout << "ERROR: Could not open " << logPath << " for writing" << std::endl;
+			logging = false;
+			return false;
+		}
+
+		logFile << "frame,cpu_ms";
+		for (int stage = 0; stage < STAGE_COUNT; stage++) {
+			std::string name = stageNames[stage];
+			std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+			logFile << "," << name << "_ms";
+		}
+		logFile << ",gpu_ms,rays,rays_per_second,light_bounces,shadow_rays\n";
+		logging = true;
+		return true;
+	}
+
+	void stopLog() {
+		if (logFile.is_open()) logFile.close();
+		logging = false;
+	}
+
+	void cleanup() {
+		stopLog();
+		if (!initialized) return;
+
+		for (Frame& frame : frames) glDeleteQueries(STAGE_COUNT * 2, &frame.queries[0][0]);
+		initialized = false;
+	}
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <GL/glew.h>
+
+#define PROFILER_FRAMES 4 // Frames whose queries can be in flight at once. A frame is only timed if its slot's previous results have been collected.
+#define PROFILER_SMOOTHING 0.1f // Weight of the newest frame in the displayed averages
+
+// Measures how long the GPU spends on every stage of a frame, without ever waiting for it.
+// Each stage is bracketed by two GL_TIMESTAMP queries from a ring of PROFILER_FRAMES slots, whose results are collected frames later.
+// Timestamps are used instead of GL_TIME_ELAPSED queries because those can't be nested, and the governor already times each band with one.
+namespace Profiler {
+	enum Stage {
+		STAGE_REPROJECTION,
+		STAGE_ACCUMULATION,
+		STAGE_BLOOM,
+		STAGE_DISPLAY,
+		STAGE_GUI,
+		STAGE_COUNT
+	};
+
+	extern const char* stageNames[STAGE_COUNT];
+	extern float stageMilliseconds[STAGE_COUNT]; // Moving averages of the GPU time of each stage
+	extern float gpuMilliseconds; // Moving average of the sum of the stages
+	extern float cpuMilliseconds; // Moving average of the whole frame time measured on the CPU, buffer swap included
+	extern double raysPerSecond; // Estimated rays traced by the accumulation stage, per second of its GPU time
+
+	extern bool logging; // Whether every collected frame is written to logPath
+	extern char logPath[256];
+
+	void beginFrame();
+	void beginStage(Stage stage);
+	void endStage(Stage stage);
+	void endFrame(float frameMilliseconds, double rays, int lightBounces, int shadowRays);
+	bool startLog();
+	void stopLog();
+	void cleanup();
+}
@@ -1,6 +1,11 @@
 #include <string>
+#include <cmath>
+#include <glm/gtc/constants.hpp>
 
 #include "scene.h"
+#include "bvh.h"
+#include "lighttree.h"
+#include "accumulation.h"
 
 #include <iostream>
 #include "gui.h"
@@ -9,21 +14,41 @@ extern bool refreshRequired;
 
 namespace Scene {
 	GLuint boundShader;
+	GLuint objectBuffer;
+	std::vector<int> emitters;
+	GLuint emitterBuffer;
+	GLuint lightBuffer;
+	GLuint convergenceBuffers[CONVERGENCE_RING_SIZE];
+	GLsync convergenceFences[CONVERGENCE_RING_SIZE]; // Set once the passes counting into a buffer are all issued, until it is read back
+	int convergencePixels[CONVERGENCE_RING_SIZE]; // Pixels rendered by the passes counting into each buffer
+	int convergenceSlot = 0; // Buffer the passes count into
 	std::vector<Object> objects;
 	std::vector<PointLight> lights;
 	Material planeMaterial;
 
 	GLuint skyboxTexture;
+	GLuint skyboxMarginalCdfTexture, skyboxConditionalCdfTexture;
+	bool skyboxSampling = false; // Whether the CDF textures describe the current skybox
 
 	glm::vec3 cameraPosition(0, 1, 2);
 	float cameraYaw = 0.0f, cameraPitch = 0.0f;
 
-	int shadowResolution = 20;
+	int shadowRays = 1;
 	int lightBounces = 5;
+	int rouletteDepth = 3;
 	int framePasses = 4;
+	float adaptiveThreshold = 0.01f;
+	bool previewEnabled = true;
+	float previewScale = 0.5f;
+	int previewBounces = 2;
+	float previewDelay = 250.0f;
+	bool reprojectionEnabled = true;
+	int reprojectionHistory = 64;
+	float convergedFraction = 0.0f;
 	float blur = 0.002f; // Slight blur (les than a pixel) = anti-aliasing
 	float bloomRadius = 0.02f;
 	float bloomIntensity = 0.5f;
+	float bloomThreshold = 1.0f;
 	float skyboxStrength = 1.0F;
 	float skyboxGamma = 2.2F;
 	float skyboxCeiling = 10.0F;
@@ -69,31 +94,176 @@ namespace Scene {
 
 	}
 
+	// Must match isEmitter in common.glsl
+	bool isEmitter(const Object& object) {
+		const Material& material = object.material;
+		return object.type == 1 && material.emissionStrength > 0.0f && (material.emission[0] > 0.0f || material.emission[1] > 0.0f || material.emission[2] > 0.0f);
+	}
+
+	// Rebuilds the emitter list and uploads it, preceded by its length, to the emitter SSBO
+	void sendEmitters() {
+		if (!emitterBuffer) glGenBuffers(1, &emitterBuffer);
+
+		emitters.clear();
+		for (int i = 0; i < objects.size(); i++) {
+			if (isEmitter(objects[i])) emitters.push_back(i);
+		}
+
+		GLint emitterCount = (GLint)emitters.size();
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, emitterBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, (emitters.size() + 1) * sizeof(GLint), nullptr, GL_DYNAMIC_DRAW);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLint), &emitterCount);
+		if (!emitters.empty()) glBufferSubData(GL_SHADER_STORAGE_BUFFER, sizeof(GLint), emitters.size() * sizeof(GLint), emitters.data());
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 8, emitterBuffer); // Binding 8 = EmitterBuffer in common.glsl
+	}
+
+	// Uploads the whole object list to the object SSBO in a single call. Must be called whenever objects are added or removed.
+	void sendObjects() {
+		if (!objectBuffer) glGenBuffers(1, &objectBuffer);
+
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectBuffer);
+		// At least one element is always allocated so the buffer stays valid when the scene is empty
+		glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(objects.size(), 1) * sizeof(Object), objects.empty() ? nullptr : objects.data(), GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, objectBuffer); // Binding 0 = ObjectBuffer in common.glsl
+
+		glUniform1i(glGetUniformLocation(boundShader, "u_objectCount"), (GLint)objects.size());
+
+		BVH::build(objects);
+		BVH::upload();
+		sendEmitters();
+	}
+
+	// Updates a single object in place. The object must already be part of the uploaded buffer.
 	void sendObjectData(int objectIndex) {
-		std::string i_str = std::to_string(objectIndex);
-		glUniform1ui(glGetUniformLocation(boundShader, std::string("u_objects[").append(i_str).append("].type").c_str()), objects[objectIndex].type);
-		glUniform3f(glGetUniformLocation(boundShader, std::string("u_objects[").append(i_str).append("].position").c_str()), objects[objectIndex].position[0], objects[objectIndex].position[1], objects[objectIndex].position[2]);
-		glUniform3f(glGetUniformLocation(boundShader, std::string("u_objects[").append(i_str).append("].scale").c_str()), objects[objectIndex].scale[0], objects[objectIndex].scale[1], objects[objectIndex].scale[2]);
-		glUniform3f(glGetUniformLocation(boundShader, std::string("u_objects[").append(i_str).append("].material.albedo").c_str()), objects[objectIndex].material.albedo[0], objects[objectIndex].material.albedo[1], objects[objectIndex].material.albedo[2]);
-		glUniform3f(glGetUniformLocation(boundShader, std::string("u_objects[").append(i_str).append("].material.specular").c_str()), objects[objectIndex].material.specular[0], objects[objectIndex].material.specular[1], objects[objectIndex].material.specular[2]);
-		glUniform3f(glGetUniformLocation(boundShader, std::string("u_objects[").append(i_str).append("].material.emission").c_str()), objects[objectIndex].material.emission[0], objects[objectIndex].material.emission[1], objects[objectIndex].material.emission[2]);
-		glUniform1f(glGetUniformLocation(boundShader, std::string("u_objects[").append(i_str).append("].material.emissionStrength").c_str()), objects[objectIndex].material.emissionStrength);
-		glUniform1f(glGetUniformLocation(boundShader, std::string("u_objects[").append(i_str).append("].material.roughness").c_str()), objects[objectIndex].material.roughness);
-		glUniform1f(glGetUniformLocation(boundShader, std::string("u_objects[").append(i_str).append("].material.specularHighlight").c_str()), objects[objectIndex].material.specularHighlight);
-		glUniform1f(glGetUniformLocation(boundShader, std::string("u_objects[").append(i_str).append("].material.specularExponent").c_str()), objects[objectIndex].material.specularExponent);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, objectBuffer);
+		glBufferSubData(GL_SHADER_STORAGE_BUFFER, objectIndex * sizeof(Object), sizeof(Object), &objects[objectIndex]);
+
+		BVH::refit(objects);
+		BVH::upload();
+
+		// Editing the emission or the type can add or remove an emitter
+		sendEmitters();
 	}
 
-	void bind(GLuint shaderProgram) {
-		boundShader = shaderProgram;
+	// Uploads every light to the light SSBO and rebuilds the light tree used to pick them. Must be called whenever lights are added, removed or edited.
+	void sendLights() {
+		if (!lightBuffer) glGenBuffers(1, &lightBuffer);
 
-		for (int i = 0; i < lights.size(); i++) {
-			glUniform3f(glGetUniformLocation(shaderProgram, std::string("u_lights[").append(std::to_string(i)).append("].position").c_str()), lights[i].position[0], lights[i].position[1], lights[i].position[2]);
-			glUniform1f(glGetUniformLocation(shaderProgram, std::string("u_lights[").append(std::to_string(i)).append("].radius").c_str()), lights[i].radius);
-			glUniform3f(glGetUniformLocation(shaderProgram, std::string("u_lights[").append(std::to_string(i)).append("].color").c_str()), lights[i].color[0], lights[i].color[1], lights[i].color[2]);
-			glUniform1f(glGetUniformLocation(shaderProgram, std::string("u_lights[").append(std::to_string(i)).append("].power").c_str()), lights[i].power);
-			glUniform1f(glGetUniformLocation(shaderProgram, std::string("u_lights[").append(std::to_string(i)).append("].reach").c_str()), lights[i].reach);
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, lightBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, std::max<size_t>(lights.size(), 1) * sizeof(PointLight), lights.empty() ? nullptr : lights.data(), GL_DYNAMIC_DRAW);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 9, lightBuffer); // Binding 9 = LightBuffer in common.glsl
+
+		LightTree::build(lights);
+		LightTree::upload();
+	}
+
+	// Creates the counters of pixels skipped by adaptive sampling if needed, and sets them all back to 0
+	void resetConvergence() {
+		GLuint convergedPixels = 0;
+		if (!convergenceBuffers[0]) glGenBuffers(CONVERGENCE_RING_SIZE, convergenceBuffers);
+
+		for (int slot = 0; slot < CONVERGENCE_RING_SIZE; slot++) {
+			if (convergenceFences[slot]) glDeleteSync(convergenceFences[slot]);
+			convergenceFences[slot] = nullptr;
+			convergencePixels[slot] = 0;
+
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, convergenceBuffers[slot]);
+			glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(GLuint), &convergedPixels, GL_DYNAMIC_READ);
 		}
 
+		convergenceSlot = 0;
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, convergenceBuffers[convergenceSlot]); // Binding 11 = ConvergenceBuffer in common.glsl
+	}
+
+	// Reads back the counters whose passes the GPU has finished, oldest first, and clears them for reuse
+	void collectConvergence() {
+		for (int i = 1; i < CONVERGENCE_RING_SIZE; i++) {
+			int slot = (convergenceSlot + i) % CONVERGENCE_RING_SIZE;
+			if (!convergenceFences[slot]) continue;
+			if (glClientWaitSync(convergenceFences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 0) == GL_TIMEOUT_EXPIRED) break;
+			glDeleteSync(convergenceFences[slot]);
+			convergenceFences[slot] = nullptr;
+
+			GLuint convergedPixels = 0;
+			glBindBuffer(GL_SHADER_STORAGE_BUFFER, convergenceBuffers[slot]);
+			glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &convergedPixels);
+			if (convergencePixels[slot] > 0) convergedFraction = (float)convergedPixels / convergencePixels[slot];
+
+			convergedPixels = 0;
+			glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(GLuint), &convergedPixels);
+			convergencePixels[slot] = 0;
+		}
+	}
+
+	// Called once the passes of a frame are issued: the counter they used is read back in a later frame, and the next passes count into another one.
+	// Never waits for the GPU. If it is so far behind that no counter is free, the passes of the next frame keep counting into the current one.
+	void updateConvergence(int pixelCount) {
+		collectConvergence();
+
+		convergencePixels[convergenceSlot] += pixelCount;
+		int nextSlot = (convergenceSlot + 1) % CONVERGENCE_RING_SIZE;
+		if (convergenceFences[nextSlot]) return;
+
+		glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT); // Makes the atomic counts visible to glGetBufferSubData
+		convergenceFences[convergenceSlot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		convergenceSlot = nextSlot;
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 11, convergenceBuffers[convergenceSlot]);
+	}
+
+	void uploadCdfTexture(GLuint texture, GLenum unit, int width, int height, const float* data) {
+		glActiveTexture(unit);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED, GL_FLOAT, data);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	}
+
+	// Uploads an equirectangular RGB skybox to texture unit 1, along with the tables used to sample it in proportion to its brightness:
+	// a marginal CDF over the rows (unit 2) and one conditional CDF per row (unit 3)
+	void loadSkybox(const float* data, int width, int height) {
+		if (!skyboxTexture) glGenTextures(1, &skyboxTexture);
+		if (!skyboxMarginalCdfTexture) glGenTextures(1, &skyboxMarginalCdfTexture);
+		if (!skyboxConditionalCdfTexture) glGenTextures(1, &skyboxConditionalCdfTexture);
+
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, skyboxTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, width, height, 0, GL_RGB, GL_FLOAT, data);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		std::vector<float> conditionalCdf((size_t)width * height);
+		std::vector<float> marginalCdf(height);
+		float total = 0.0f;
+		for (int y = 0; y < height; y++) {
+			// Rows near the poles cover less solid angle
+			float sinTheta = std::sin((y + 0.5f) / height * glm::pi<float>());
+			float* row = &conditionalCdf[(size_t)y * width];
+
+			float rowSum = 0.0f;
+			for (int x = 0; x < width; x++) {
+				const float* pixel = data + ((size_t)y * width + x) * 3;
+				rowSum += std::max(0.2126f * pixel[0] + 0.7152f * pixel[1] + 0.0722f * pixel[2], 0.0f) * sinTheta;
+				row[x] = rowSum;
+			}
+
+			// Rows without any light are never picked, but still get a valid CDF
+			for (int x = 0; x < width; x++) row[x] = rowSum > 0.0f ? row[x] / rowSum : (x + 1.0f) / width;
+
+			total += rowSum;
+			marginalCdf[y] = total;
+		}
+		for (int y = 0; y < height; y++) marginalCdf[y] = total > 0.0f ? marginalCdf[y] / total : (y + 1.0f) / height;
+
+		uploadCdfTexture(skyboxMarginalCdfTexture, GL_TEXTURE2, height, 1, marginalCdf.data());
+		uploadCdfTexture(skyboxConditionalCdfTexture, GL_TEXTURE3, width, height, conditionalCdf.data());
+		glActiveTexture(GL_TEXTURE0);
+
+		skyboxSampling = total > 0.0f;
+		if (boundShader) glUniform1i(glGetUniformLocation(boundShader, "u_skyboxSampling"), skyboxSampling);
+	}
+
+	// Uploads the plane and the render settings to the program currently in use
+	void sendUniforms(GLuint shaderProgram) {
 		glUniform3f(glGetUniformLocation(shaderProgram, "u_planeMaterial.albedo"), planeMaterial.albedo[0], planeMaterial.albedo[1], planeMaterial.albedo[2]);
 		glUniform3f(glGetUniformLocation(shaderProgram, "u_planeMaterial.specular"), planeMaterial.specular[0], planeMaterial.specular[1], planeMaterial.specular[2]);
 		glUniform3f(glGetUniformLocation(shaderProgram, "u_planeMaterial.emission"), planeMaterial.emission[0], planeMaterial.emission[1], planeMaterial.emission[2]);
@@ -102,65 +272,37 @@ namespace Scene {
 		glUniform1f(glGetUniformLocation(shaderProgram, "u_planeMaterial.specularHighlight"), planeMaterial.specularHighlight);
 		glUniform1f(glGetUniformLocation(shaderProgram, "u_planeMaterial.specularExponent"), planeMaterial.specularExponent);
 
-		glUniform1i(glGetUniformLocation(shaderProgram, "u_shadowResolution"), shadowResolution);
+		glUniform1i(glGetUniformLocation(shaderProgram, "u_shadowRays"), shadowRays);
 		glUniform1i(glGetUniformLocation(shaderProgram, "u_lightBounces"), lightBounces);
+		glUniform1i(glGetUniformLocation(shaderProgram, "u_rouletteDepth"), rouletteDepth);
 		glUniform1i(glGetUniformLocation(shaderProgram, "u_framePasses"), framePasses);
+		glUniform1f(glGetUniformLocation(shaderProgram, "u_adaptiveThreshold"), adaptiveThreshold);
+		glUniform1i(glGetUniformLocation(shaderProgram, "u_maxHistory"), reprojectionHistory);
+		glUniform1i(glGetUniformLocation(shaderProgram, "u_packedAccumulation"), Accumulation::packed);
 		glUniform1f(glGetUniformLocation(shaderProgram, "u_blur"), blur);
-		glUniform1f(glGetUniformLocation(shaderProgram, "u_bloomRadius"), bloomRadius);
 		glUniform1f(glGetUniformLocation(shaderProgram, "u_bloomIntensity"), bloomIntensity);
 		glUniform1f(glGetUniformLocation(shaderProgram, "u_skyboxStrength"), skyboxStrength);
 		glUniform1f(glGetUniformLocation(shaderProgram, "u_skyboxGamma"), skyboxGamma);
 		glUniform1f(glGetUniformLocation(shaderProgram, "u_skyboxCeiling"), skyboxCeiling);
+		glUniform1i(glGetUniformLocation(shaderProgram, "u_skyboxSampling"), skyboxSampling);
+		glUniform1i(glGetUniformLocation(shaderProgram, "u_skyboxMarginalCdf"), 2);
+		glUniform1i(glGetUniformLocation(shaderProgram, "u_skyboxConditionalCdf"), 3);
 
-		for (int i = 0; i < objects.size(); i++) {
-			sendObjectData(i);
-		}
-
-		glUniform1i(glGetUniformLocation(boundShader, "u_selectedSphereIndex"), selectedObjectIndex);
-		glUniform1i(glGetUniformLocation(boundShader, "u_planeVisible"), planeVisible);
-	}
-
-	void unbind() {
-		boundShader = 0;
+		glUniform1i(glGetUniformLocation(shaderProgram, "u_selectedSphereIndex"), selectedObjectIndex);
+		glUniform1i(glGetUniformLocation(shaderProgram, "u_planeVisible"), planeVisible);
 	}
 
-	bool sphereIntersection(glm::vec3 position, float radius, glm::vec3 rayOrigin, glm::vec3 rayDirection, float* hitDistance) {
-		float t = glm::dot(position - rayOrigin, rayDirection);
-		glm::vec3 p = rayOrigin + rayDirection * t;
-
-		float y = glm::length(position - p);
-		if (y < radius) {
-			float x = sqrt(radius * radius - y * y);
-			float t1 = t - x;
-			if (t1 > 0) {
-				*hitDistance = t1;
-				return true;
-			}
-
-		}
+	void bind(GLuint shaderProgram) {
+		boundShader = shaderProgram;
 
-		return false;
+		sendUniforms(shaderProgram);
+		sendObjects();
+		sendLights();
+		resetConvergence();
 	}
 
-	bool boxIntersection(glm::vec3 position, glm::vec3 size, glm::vec3 rayOrigin, glm::vec3 rayDirection, float* hitDistance) {
-		float t1 = -1000000000000.0;
-		float t2 = 1000000000000.0;
-
-		glm::vec3 boxMin = position - size / 2.0f;
-		glm::vec3 boxMax = position + size / 2.0f;
-
-		glm::vec3 t0s = (boxMin - rayOrigin) / rayDirection;
-		glm::vec3 t1s = (boxMax - rayOrigin) / rayDirection;
-
-		glm::vec3 tsmaller = min(t0s, t1s);
-		glm::vec3 tbigger = max(t0s, t1s);
-
-		t1 = std::max({ t1, tsmaller.x, tsmaller.y, tsmaller.z });
-		t2 = std::min({ t2, tbigger.x, tbigger.y, tbigger.z });
-
-		*hitDistance = t1;
-
-		return t1 >= 0 && t1 <= t2;
+	void unbind() {
+		boundShader = 0;
 	}
 
 	bool planeIntersection(glm::vec3 planeNormal, glm::vec3 planePoint, glm::vec3 rayOrigin, glm::vec3 rayDirection, float* hitDistance)
@@ -175,31 +317,16 @@ namespace Scene {
 		return false;
 	}
 
-	void selectHovered(float mouseX, float mouseY, int screenWidth, int screenHeight, glm::vec3 cameraPosition, glm::mat4 rotationMatrix) {
-		float relativeMouseX = mouseX / screenWidth;
-		float relativeMouseY = 1.0 - mouseY / screenHeight;
-		glm::vec2 centeredUV = (2.0f * glm::vec2(relativeMouseX, relativeMouseY) - glm::vec2(1.0)) * glm::vec2((float)screenWidth / screenHeight, 1.0);
-		glm::vec3 rayDir = glm::normalize(glm::vec4(centeredUV, -1.0, 0.0)) * rotationMatrix;
-
-		float minDist = -1;
-		selectedObjectIndex = -1;
-		for (int sphereIndex = 0; sphereIndex < objects.size(); sphereIndex++) {
-			if (objects[sphereIndex].type == 0) continue;
-
-			float dist;
-			if (objects[sphereIndex].type == 1 && sphereIntersection(glm::vec3(objects[sphereIndex].position[0], objects[sphereIndex].position[1], objects[sphereIndex].position[2]), objects[sphereIndex].scale[0], cameraPosition, rayDir, &dist)) {
-				if (minDist == -1 || dist < minDist) {
-					minDist = dist;
-					selectedObjectIndex = sphereIndex;
-				}
-			}
-			else if (objects[sphereIndex].type == 2 && boxIntersection(glm::vec3(objects[sphereIndex].position[0], objects[sphereIndex].position[1], objects[sphereIndex].position[2]), glm::vec3(objects[sphereIndex].scale[0], objects[sphereIndex].scale[1], objects[sphereIndex].scale[2]), cameraPosition, rayDir, &dist)) {
-				if (minDist == -1 || dist < minDist) {
-					minDist = dist;
-					selectedObjectIndex = sphereIndex;
-				}
-			}
+	// Selects the object seen through the given pixel of the accumulation targets, as recorded in their object ID attachment by the last reprojection pass
+	void selectHovered(int pixelX, int pixelY) {
+		GLint objectIndex = -1;
+		if (pixelX >= 0 && pixelY >= 0 && pixelX < Accumulation::width && pixelY < Accumulation::height) {
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, Accumulation::framebuffers[Accumulation::current]);
+			glReadBuffer(GL_COLOR_ATTACHMENT3);
+			glReadPixels(pixelX, pixelY, 1, 1, GL_RED_INTEGER, GL_INT, &objectIndex);
+			glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
 		}
+		selectedObjectIndex = objectIndex >= 0 && objectIndex < (int)objects.size() ? objectIndex : -1;
 
 		if (boundShader) {
 			glUniform1i(glGetUniformLocation(boundShader, "u_selectedSphereIndex"), selectedObjectIndex);
@@ -228,7 +355,7 @@ namespace Scene {
 					objects.push_back(Object(1, { position[0], position[1] + 1.0f, position[2] }, { 1.0f, 1.0f, 1.0f }, Material({ 1.0f, 1.0f, 1.0f }, { 0.0f, 0.0f, 0.0f }, {0.0f, 0.0f, 0.0f}, 0.0f, 1.0f, 0.0f, 0.0f)));
 				}
 
-				sendObjectData(objects.size() - 1);
+				sendObjects();
 				refreshRequired = true;
 			}
 		}
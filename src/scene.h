@@ -6,6 +6,8 @@
 #include <algorithm>
 #include <vector>
 
+#define CONVERGENCE_RING_SIZE 3 // Convergence counters in flight at once, so that reading one back never waits for the passes that count into another
+
 namespace Scene {
 	struct Material {
 		float albedo[3];
@@ -31,6 +33,9 @@ namespace Scene {
 		Object();
 	};
 
+	// Objects are uploaded to the object SSBO as-is, so their layout must match PackedObject in common.glsl (20 tightly packed 4-byte fields)
+	static_assert(sizeof(Object) == 20 * sizeof(float), "Scene::Object no longer matches the std430 layout of PackedObject");
+
 	struct PointLight {
 		float position[3];
 		float radius;
@@ -42,29 +47,58 @@ namespace Scene {
 		PointLight();
 	};
 
+	// Lights are uploaded to the light SSBO as-is, so their layout must match PackedPointLight in common.glsl
+	static_assert(sizeof(PointLight) == 9 * sizeof(float), "Scene::PointLight no longer matches the std430 layout of PackedPointLight");
+
 	extern glm::vec3 cameraPosition;
 	extern float cameraYaw, cameraPitch;
 
 	extern GLuint boundShader;
+	extern GLuint objectBuffer;
+	extern std::vector<int> emitters; // Indices of the emissive spheres, which the shaders sample directly
+	extern GLuint emitterBuffer;
+	extern GLuint lightBuffer;
+	extern GLuint convergenceBuffers[CONVERGENCE_RING_SIZE]; // Pixels skipped by adaptive sampling, counted by the passes of one or more frames each
 	extern std::vector<Object> objects;
 	extern std::vector<PointLight> lights;
 	extern Material planeMaterial;
-	extern int shadowResolution;
+	extern int shadowRays;
 	extern int lightBounces;
+	extern int rouletteDepth;
 	extern int framePasses;
+	extern float adaptiveThreshold; // Relative error under which pixels stop being sampled, 0 to disable adaptive sampling
+	extern float convergedFraction; // Lags a frame or two behind the passes it describes
+	extern bool previewEnabled; // Render at a reduced resolution and bounce count while the camera moves
+	extern float previewScale; // Fraction of the window size the preview renders at
+	extern int previewBounces;
+	extern float previewDelay; // Milliseconds the camera must stay still before full quality resumes
+	extern bool reprojectionEnabled; // Keep the samples still visible after a camera move instead of discarding all of them
+	extern int reprojectionHistory; // Passes a pixel keeps at most when it is reprojected
 	extern float blur;
-	extern float bloomRadius;
+	extern float bloomRadius; // Reach of the bloom relative to the screen height
 	extern float bloomIntensity;
+	extern float bloomThreshold; // Luminance above which pixels bloom
 	extern float skyboxStrength;
 	extern float skyboxGamma;
 	extern float skyboxCeiling;
 	extern int selectedObjectIndex;
 	extern GLuint skyboxTexture;
+	extern GLuint skyboxMarginalCdfTexture, skyboxConditionalCdfTexture;
+	extern bool skyboxSampling;
 	extern bool planeVisible;
 
+	void resetConvergence();
+	void updateConvergence(int pixelCount);
+	void loadSkybox(const float* data, int width, int height);
+	void sendUniforms(GLuint shaderProgram);
 	void bind(GLuint shaderProgram);
 	void unbind();
-	void selectHovered(float mouseX, float mouseY, int screenWidth, int screenHeight, glm::vec3 cameraPosition, glm::mat4 rotationMatrix);
+	bool isEmitter(const Object& object);
+	void sendEmitters();
+	void sendObjects();
+	void sendLights();
+	void sendObjectData(int objectIndex);
+	void selectHovered(int pixelX, int pixelY);
 	void mousePlace(float mouseX, float mouseY, int screenWidth, int screenHeight, glm::vec3 cameraPosition, glm::mat4 rotationMatrix);
 }
 
@@ -0,0 +1,127 @@
+#include "shader.h"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+// Reads a shader from disk. Lines of the form #include "file" are replaced by the contents of that file (relative to the including one) and the given defines are inserted right after the #version line.
+bool loadShaderSource(const char* filepath, std::string& source, const std::string& defines) {
+	std::ifstream stream(filepath, std::ios::in);
+	if (!stream.is_open()) {
+		printf("Unable to open %s.\n", filepath);
+		return false;
+	}
+
+	std::string directory(filepath);
+	size_t separator = directory.find_last_of("\\/");
+	directory = separator == std::string::npos ? "" : directory.substr(0, separator + 1);
+
+	std::stringstream sstr;
+	std::string line;
+	bool versionFound = false;
+	while (std::getline(stream, line)) {
+		size_t start = line.find_first_not_of(" \t");
+		if (start != std::string::npos && line.compare(start, 8, "#include") == 0) {
+			size_t open = line.find('"', start);
+			size_t close = open == std::string::npos ? std::string::npos : line.find('"', open + 1);
+			if (close == std::string::npos) {
+				printf("Malformed #include in %s: %s\n", filepath, line.c_str());
+				return false;
+			}
+
+			std::string includedSource;
+			if (!loadShaderSource((directory + line.substr(open + 1, close - open - 1)).c_str(), includedSource)) return false;
+			sstr << includedSource << "\n";
+		}
+		else {
+			sstr << line << "\n";
+			if (!versionFound && start != std::string::npos && line.compare(start, 8, "#version") == 0) {
+				sstr << defines;
+				versionFound = true;
+			}
+		}
+	}
+
+	source = sstr.str();
+	return true;
+}
+
+GLuint compileShader(GLenum type, const std::string& source, const char* filepath) {
+	GLuint shaderID = glCreateShader(type);
+
+	GLint Result = GL_FALSE;
+	int InfoLogLength;
+
+	printf("Compiling shader : %s\n", filepath);
+	char const* sourcePointer = source.c_str();
+	glShaderSource(shaderID, 1, &sourcePointer, NULL);
+	glCompileShader(shaderID);
+
+	glGetShaderiv(shaderID, GL_COMPILE_STATUS, &Result);
+	glGetShaderiv(shaderID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	if (InfoLogLength > 0) {
+		std::vector<char> shaderErrorMessage(InfoLogLength + 1);
+		glGetShaderInfoLog(shaderID, InfoLogLength, NULL, &shaderErrorMessage[0]);
+		printf("%s\n", &shaderErrorMessage[0]);
+	}
+
+	return shaderID;
+}
+
+GLuint linkProgram(GLuint ProgramID) {
+	GLint Result = GL_FALSE;
+	int InfoLogLength;
+
+	printf("Linking program\n");
+	glLinkProgram(ProgramID);
+
+	glGetProgramiv(ProgramID, GL_LINK_STATUS, &Result);
+	glGetProgramiv(ProgramID, GL_INFO_LOG_LENGTH, &InfoLogLength);
+	if (InfoLogLength > 0) {
+		std::vector<char> ProgramErrorMessage(InfoLogLength + 1);
+		glGetProgramInfoLog(ProgramID, InfoLogLength, NULL, &ProgramErrorMessage[0]);
+		printf("%s\n", &ProgramErrorMessage[0]);
+	}
+
+	return ProgramID;
+}
+
+// Loads the shader sources from disk and returns a new OpenGL Program
+GLuint createShaderProgram(const char* vertex_file_path, const char* fragment_file_path) {
+	std::string VertexShaderCode, FragmentShaderCode;
+	if (!loadShaderSource(vertex_file_path, VertexShaderCode) || !loadShaderSource(fragment_file_path, FragmentShaderCode)) return 0;
+
+	GLuint VertexShaderID = compileShader(GL_VERTEX_SHADER, VertexShaderCode, vertex_file_path);
+	GLuint FragmentShaderID = compileShader(GL_FRAGMENT_SHADER, FragmentShaderCode, fragment_file_path);
+
+	GLuint ProgramID = glCreateProgram();
+	glAttachShader(ProgramID, VertexShaderID);
+	glAttachShader(ProgramID, FragmentShaderID);
+	linkProgram(ProgramID);
+
+	glDetachShader(ProgramID, VertexShaderID);
+	glDetachShader(ProgramID, FragmentShaderID);
+
+	glDeleteShader(VertexShaderID);
+	glDeleteShader(FragmentShaderID);
+
+	return ProgramID;
+}
+
+// Same as createShaderProgram for a single compute shader. The defines let one source file provide several programs.
+GLuint createComputeProgram(const char* compute_file_path, const std::string& defines) {
+	std::string ComputeShaderCode;
+	if (!loadShaderSource(compute_file_path, ComputeShaderCode, defines)) return 0;
+
+	GLuint ComputeShaderID = compileShader(GL_COMPUTE_SHADER, ComputeShaderCode, compute_file_path);
+
+	GLuint ProgramID = glCreateProgram();
+	glAttachShader(ProgramID, ComputeShaderID);
+	linkProgram(ProgramID);
+
+	glDetachShader(ProgramID, ComputeShaderID);
+	glDeleteShader(ComputeShaderID);
+
+	return ProgramID;
+}
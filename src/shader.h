@@ -0,0 +1,8 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <string>
+
+bool loadShaderSource(const char* filepath, std::string& source, const std::string& defines = "");
+GLuint createShaderProgram(const char* vertex_file_path, const char* fragment_file_path);
+GLuint createComputeProgram(const char* compute_file_path, const std::string& defines = "");
@@ -0,0 +1,161 @@
+#include "wavefront.h"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "scene.h"
+#include "accumulation.h"
+#include "shader.h"
+
+#define PATH_STATE_SIZE 64 // Size of PathState in wavefront.comp
+#define SHADOW_RAY_SIZE 48 // Size of ShadowRay in wavefront.comp
+#define QUEUE_COUNTERS_SIZE 32 // Size of the QueueCounters block in wavefront.comp
+#define DISPATCH_ARGS_OFFSET 16 // Offset of u_dispatchArgs in the QueueCounters block
+
+#define QUEUE_EXTEND 0
+#define QUEUE_SHADE 1
+#define QUEUE_SHADOW 2
+
+#define STAGE_BARRIERS (GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT)
+
+namespace Wavefront {
+	bool enabled = false;
+
+	enum Stage { PREPARE, GENERATE, EXTEND, SHADE, SHADOW, ACCUMULATE, STAGE_COUNT };
+	const char* stageDefines[STAGE_COUNT] = { "#define STAGE_PREPARE\n", "#define STAGE_GENERATE\n", "#define STAGE_EXTEND\n", "#define STAGE_SHADE\n", "#define STAGE_SHADOW\n", "#define STAGE_ACCUMULATE\n" };
+
+	GLuint programs[STAGE_COUNT];
+	bool programsPacked; // Accumulation::packed when the programs were compiled, as the color image format is baked into them
+	GLuint pathBuffer, extendQueueBuffer, shadeQueueBuffer, shadowQueueBuffer, counterBuffer;
+	int bufferWidth = 0, bufferHeight = 0;
+
+	void allocateBuffer(GLuint buffer, GLuint binding, size_t size) {
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, size, nullptr, GL_DYNAMIC_COPY);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, binding, buffer); // Bindings 3 to 7 match the buffer blocks in wavefront.comp
+	}
+
+	// (Re)allocates the path state and the queues so that every pixel has its own path
+	void allocate(int width, int height) {
+		if (!pathBuffer) {
+			glGenBuffers(1, &pathBuffer);
+			glGenBuffers(1, &extendQueueBuffer);
+			glGenBuffers(1, &shadeQueueBuffer);
+			glGenBuffers(1, &shadowQueueBuffer);
+			glGenBuffers(1, &counterBuffer);
+		}
+
+		size_t pathCount = (size_t)width * height;
+		allocateBuffer(pathBuffer, 3, pathCount * PATH_STATE_SIZE);
+		allocateBuffer(extendQueueBuffer, 4, pathCount * sizeof(GLuint));
+		allocateBuffer(shadeQueueBuffer, 5, pathCount * sizeof(GLuint));
+		allocateBuffer(shadowQueueBuffer, 6, pathCount * SHADOW_RAY_SIZE);
+		allocateBuffer(counterBuffer, 7, QUEUE_COUNTERS_SIZE);
+
+		bufferWidth = width;
+		bufferHeight = height;
+	}
+
+	void setInt(Stage stage, const char* name, int value) {
+		glUseProgram(programs[stage]);
+		glUniform1i(glGetUniformLocation(programs[stage], name), value);
+	}
+
+	// Computes the indirect dispatch arguments for one queue and empties the queues the next stage appends to
+	void prepare(int dispatchQueue, int resetQueues) {
+		glUseProgram(programs[PREPARE]);
+		glUniform1i(glGetUniformLocation(programs[PREPARE], "u_dispatchQueue"), dispatchQueue);
+		glUniform1i(glGetUniformLocation(programs[PREPARE], "u_resetQueues"), resetQueues);
+		glDispatchCompute(1, 1, 1);
+		glMemoryBarrier(STAGE_BARRIERS);
+	}
+
+	void dispatch(Stage stage, GLuint groups) {
+		glUseProgram(programs[stage]);
+		glDispatchCompute(groups, 1, 1);
+		glMemoryBarrier(STAGE_BARRIERS);
+	}
+
+	// Runs a stage over the queue prepared by the last call to prepare()
+	void dispatchIndirect(Stage stage) {
+		glUseProgram(programs[stage]);
+		glDispatchComputeIndirect(DISPATCH_ARGS_OFFSET);
+		glMemoryBarrier(STAGE_BARRIERS);
+	}
+
+	void render(int width, int height, int rowStart, int rowCount, int lightBounces, int accumulatedPasses, float time, glm::vec3 cameraPosition, glm::mat4 rotationMatrix, bool settingsChanged) {
+		GLint previousProgram;
+		glGetIntegerv(GL_CURRENT_PROGRAM, &previousProgram);
+
+		// Programs are only compiled once the backend is actually used, and again whenever the accumulation format changes
+		bool firstRender = !programs[0] || programsPacked != Accumulation::packed;
+		if (firstRender) {
+			std::string formatDefine = Accumulation::packed ? "#define ACCUMULATION_FORMAT rgba16f\n" : "#define ACCUMULATION_FORMAT rgba32f\n";
+			for (int i = 0; i < STAGE_COUNT; i++) {
+				if (programs[i]) glDeleteProgram(programs[i]);
+				programs[i] = createComputeProgram("shaders/wavefront.comp", formatDefine + stageDefines[i]);
+				glUseProgram(programs[i]);
+				glUniform1i(glGetUniformLocation(programs[i], "u_skyboxTexture"), 1); // Same texture unit as the fragment shader
+			}
+			programsPacked = Accumulation::packed;
+		}
+		if ((size_t)width * height > (size_t)bufferWidth * bufferHeight) allocate(width, height); // Kept when the preview resolution goes down
+
+		// The GUI only updates the uniforms of Scene::boundShader, so the scene settings are copied to every stage whenever they may have changed
+		for (int i = 0; i < STAGE_COUNT; i++) {
+			glUseProgram(programs[i]);
+			if (firstRender || settingsChanged) Scene::sendUniforms(programs[i]);
+
+			glUniform1f(glGetUniformLocation(programs[i], "u_time"), time);
+			glUniform3f(glGetUniformLocation(programs[i], "u_cameraPosition"), cameraPosition.x, cameraPosition.y, cameraPosition.z);
+			glUniformMatrix4fv(glGetUniformLocation(programs[i], "u_rotationMatrix"), 1, GL_FALSE, glm::value_ptr(rotationMatrix));
+			glUniform1f(glGetUniformLocation(programs[i], "u_aspectRatio"), (float)width / height);
+			glUniform2i(glGetUniformLocation(programs[i], "u_screenSize"), width, height);
+			glUniform1i(glGetUniformLocation(programs[i], "u_accumulatedPasses"), accumulatedPasses);
+			glUniform1ui(glGetUniformLocation(programs[i], "u_pathOffset"), (GLuint)((size_t)rowStart * width));
+			glUniform1ui(glGetUniformLocation(programs[i], "u_pathCount"), (GLuint)((size_t)rowCount * width));
+		}
+
+		glBindImageTexture(0, Accumulation::colorTextures[Accumulation::current], 0, GL_FALSE, 0, GL_READ_WRITE, Accumulation::colorFormat());
+		glBindImageTexture(1, Accumulation::momentsTextures[Accumulation::current], 0, GL_FALSE, 0, GL_READ_WRITE, GL_RGBA32F);
+		glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, counterBuffer);
+
+		GLuint pathGroups = (GLuint)(((size_t)width * rowCount + WAVEFRONT_WORKGROUP_SIZE - 1) / WAVEFRONT_WORKGROUP_SIZE);
+		for (int sample = 0; sample < Scene::framePasses; sample++) {
+			for (int i = 0; i < STAGE_COUNT; i++) setInt((Stage)i, "u_sampleIndex", sample);
+
+			prepare(QUEUE_EXTEND, 1 << QUEUE_EXTEND);
+			dispatch(GENERATE, pathGroups);
+
+			for (int depth = 0; depth < lightBounces; depth++) {
+				prepare(QUEUE_EXTEND, 1 << QUEUE_SHADE);
+				dispatchIndirect(EXTEND);
+
+				prepare(QUEUE_SHADE, (1 << QUEUE_EXTEND) | (1 << QUEUE_SHADOW));
+				setInt(SHADE, "u_depth", depth);
+				dispatchIndirect(SHADE);
+
+				prepare(QUEUE_SHADOW, 0);
+				dispatchIndirect(SHADOW);
+			}
+
+			dispatch(ACCUMULATE, pathGroups);
+		}
+
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+		glUseProgram(previousProgram);
+	}
+
+	void cleanup() {
+		for (int i = 0; i < STAGE_COUNT; i++) {
+			if (programs[i]) glDeleteProgram(programs[i]);
+			programs[i] = 0;
+		}
+
+		if (pathBuffer) {
+			GLuint buffers[] = { pathBuffer, extendQueueBuffer, shadeQueueBuffer, shadowQueueBuffer, counterBuffer };
+			glDeleteBuffers(5, buffers);
+			pathBuffer = 0;
+		}
+		bufferWidth = bufferHeight = 0;
+	}
+}
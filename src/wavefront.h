@@ -0,0 +1,17 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+#define WAVEFRONT_WORKGROUP_SIZE 256 // Must match WORKGROUP_SIZE in wavefront.comp
+
+// Alternative render backend that splits path tracing into compute stages (generate, extend, shade, shadow, accumulate) connected by ray queues.
+// It only replaces the accumulation pass: the result is added in place to the current accumulation target (see accumulation.h).
+// Only the rows from rowStart to rowStart + rowCount are traced, so that a pass can be split into bands (see governor.h).
+// width and height are the render resolution, which may only cover part of the accumulation targets.
+namespace Wavefront {
+	extern bool enabled;
+
+	void render(int width, int height, int rowStart, int rowCount, int lightBounces, int accumulatedPasses, float time, glm::vec3 cameraPosition, glm::mat4 rotationMatrix, bool settingsChanged);
+	void cleanup();
+}